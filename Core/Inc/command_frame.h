@@ -0,0 +1,60 @@
+#ifndef COMMAND_FRAME_H
+#define COMMAND_FRAME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// binary command frames, an alternative to the ascii protocol in command_parser.c.
+// a frame carries one command and is checked by a CRC, so it doesn't need to be sent twice.
+// all multi-byte fields are little-endian:
+//
+// offset 0  sync byte, always COMMAND_FRAME_SYNC
+// offset 1  command, the same two lowercase letters as the ascii protocol
+// offset 3  value, int32, in thousandths
+// offset 7  sequence number, counts up by one for each new command
+// offset 8  CRC-16/CCITT-FALSE of bytes 1 through 7
+//
+// so "tp=-12.5" is a5 74 70 2c cf ff ff <seq> <crc lo> <crc hi>
+
+#define COMMAND_FRAME_SYNC 0xa5
+#define COMMAND_FRAME_LEN 10
+#define COMMAND_FRAME_SCALE 1000
+
+// each frame is acknowledged with a reply frame:
+//
+// offset 0  sync byte, always COMMAND_REPLY_SYNC
+// offset 1  COMMAND_REPLY_ACK or COMMAND_REPLY_NAK
+// offset 2  sequence number
+// offset 3  CRC-16/CCITT-FALSE of bytes 1 and 2
+//
+// ACK n means every frame up to and including n has been taken.  NAK n means frame n was lost or
+// damaged, and everything from n on has to be sent again.  frames after a missing one are dropped, so
+// the host can simply go back to n.  the host may have up to COMMAND_WINDOW frames sent but not yet
+// acknowledged, which always fits in the receive buffer.
+
+#define COMMAND_REPLY_SYNC 0xa6
+#define COMMAND_REPLY_LEN 5
+#define COMMAND_REPLY_ACK 'a'
+#define COMMAND_REPLY_NAK 'n'
+#define COMMAND_WINDOW 16
+
+// feeds one received byte to the frame parser.  returns true when it completes a frame with a good CRC,
+// which can then be read with get_frame_command(), get_frame_value() and get_frame_sequence().
+
+bool command_frame_char(uint8_t c);
+
+// throws away a partly received frame, after some of its bytes were lost
+void command_frame_reset();
+
+char* get_frame_command();
+// in millionths, like every command value
+int64_t get_frame_value();
+uint8_t get_frame_sequence();
+
+// number of frames thrown away because the CRC didn't match, or the command wasn't two lowercase letters
+
+unsigned long get_frame_errors();
+
+uint16_t command_frame_crc(const uint8_t* data, int len);
+
+#endif
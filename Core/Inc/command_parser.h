@@ -1,15 +1,29 @@
 #ifndef COMMAND_PARSER_H
 #define COMMAND_PARSER_H
 
+#include "command_runner.h"
+
 #include <stdbool.h>
+#include <stdint.h>
+
+// command values are parsed into millionths (COMMAND_VALUE_SCALE)
+#define COMMAND_WHOLE_MAX 999999999999LL
+
+// number of parsed commands that can wait in the queue.  must be a power of two.
+#define COMMAND_QUEUE_LEN 16
 
-// This system expected to be accessed from two directions:
-// 1. The serial port calls command_parse_char for each character it receives.
-// 2. The main application polls get_command_received(), and calls get_command() and get_value() whenever a new command is ready.
+// This system expected to be accessed from two directions, both in the main loop (see the queue in
+// command_parser.c, which isn't safe to fill from an interrupt):
+// 1. The command runner calls command_parse_char for each character read from the serial port.
+// 2. The command runner then calls get_command() until it returns false, taking parsed commands off the
+//    queue in the order they arrived.
+// When the queue is full, new commands are dropped and counted.  The deepest the queue has been and the
+// number dropped are reported by the qc= query (telemetry.c).
 
-bool get_command_received();
-char* get_command();
-double get_value();
+bool get_command(motionCommand* command);
+
+unsigned int get_command_queue_max_depth();
+unsigned long get_command_overflows();
 
 // This parses a string of serial data for commands. Commands are of the form:
 // xy=-123.4567890
@@ -17,4 +31,8 @@ double get_value();
 
 void command_parse_char(char c);
 
+void command_parse_reset();
+
+int64_t command_parse_decimal(const char* text, int len);
+
 #endif
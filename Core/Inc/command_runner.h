@@ -2,12 +2,18 @@
 #define COMMAND_RUNNER_H
 
 #include <stdbool.h>
+#include <stdint.h>
+
+// command values are carried in millionths, so nothing on the way to a handler needs floating point
+#define COMMAND_VALUE_SCALE 1000000
 
 typedef struct motionCommand {
 	char command[3];
-	double value;
+	int64_t value;
 } motionCommand;
 
 bool poll_new_command(motionCommand* command);
 
+void command_runner_init();
+
 #endif
@@ -0,0 +1,24 @@
+#ifndef COMMAND_SCHEDULE_H
+#define COMMAND_SCHEDULE_H
+
+#include "command_runner.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// number of time-tagged commands that can be waiting at once
+#define COMMAND_SCHEDULE_LEN 8
+
+// holds on to a command if an at= came before it.  returns false if the command should run now.
+
+bool command_schedule(motionCommand* command);
+
+// takes the earliest waiting command due at or before now, with the time it was due.  planned picks
+// between the commands that are part of the motion plan and the rest (see command_planned()).
+
+bool command_schedule_next(uint64_t now, bool planned, motionCommand* command, uint64_t* time);
+
+unsigned long get_command_schedule_overflows();
+
+void command_schedule_init();
+
+#endif
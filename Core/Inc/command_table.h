@@ -0,0 +1,45 @@
+#ifndef COMMAND_TABLE_H
+#define COMMAND_TABLE_H
+
+#include "command_runner.h"
+#include <stdbool.h>
+
+// every command is a two-letter code and a number.  each module that takes commands keeps a constant
+// table of them and registers it once at start up.  a command is only handed to its handler when its
+// value is within [min, max].  values, and the limits, are in millionths (COMMAND_VALUE_SCALE).
+
+typedef void (*commandHandler)(int64_t value);
+
+// a whole number as a command value, for the limits in the tables
+#define COMMAND_VALUE(whole) ((int64_t)(whole) * COMMAND_VALUE_SCALE)
+
+typedef struct commandEntry {
+	char command[3];
+	int64_t min;
+	int64_t max;
+	const char* units;
+	commandHandler handler;
+	// part of the motion plan, so the planner runs it itself when it's scheduled with at=.  tables can
+	// leave this out for commands that aren't.
+	bool planned;
+} commandEntry;
+
+// number of commands that can be registered.  must be a power of two, and comfortably more than the
+// number of commands so lookups rarely probe more than one slot.
+#define COMMAND_TABLE_LEN 32
+
+bool command_register(const commandEntry* entries, int count);
+
+// runs a command.  returns false if the command is unknown or its value is out of range.
+
+bool command_dispatch(motionCommand* command);
+
+// whether a command is part of the motion plan (see commandEntry).  false for unknown commands.
+
+bool command_planned(const motionCommand* command);
+
+unsigned long get_command_rejected();
+
+void command_table_init();
+
+#endif
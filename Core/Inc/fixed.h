@@ -0,0 +1,88 @@
+#ifndef INC_FIXED_H_
+#define INC_FIXED_H_
+
+#include <stdint.h>
+
+// fixed-point math for the motion planner.
+// the STM32F103 has no FPU, so anything that runs every loop iteration is done in integer math.
+// everything is in the step domain, with time in microseconds:
+//
+// fix_pos - position in steps, Q32.32
+// fix_vel - velocity in steps per microsecond, Q32
+// fix_acc - acceleration in steps per microsecond^2, Q48
+//
+// a Q32.32 position covers the same +/- 2^31 step range as the int step counter in the main loop.
+
+typedef int64_t fix_pos;
+typedef int64_t fix_vel;
+typedef int64_t fix_acc;
+
+#define FIX_POS_ONE_STEP (1LL << 32)
+
+// (num << shift) / den, without overflowing when num is large.
+// den must be positive and well under 2^(63 - shift).
+
+static inline uint64_t fix_div_shift(uint64_t num, uint64_t den, int shift) {
+	uint64_t q = num / den;
+	uint64_t r = num % den;
+	return (q << shift) + ((r << shift) / den);
+}
+
+// velocity gained after accelerating at a for t microseconds
+
+static inline fix_vel fix_velocity_gain(fix_acc a, uint64_t t) {
+	return (a * (int64_t)t) >> 16;
+}
+
+// distance covered in t microseconds starting at velocity v with acceleration a (v*t + a*t*t/2)
+
+static inline fix_pos fix_travel(fix_vel v, fix_acc a, uint64_t t) {
+	return v * (int64_t)t + ((fix_velocity_gain(a, t) * (int64_t)t) >> 1);
+}
+
+// microseconds needed to change velocity by dv (>= 0) at acceleration a (> 0)
+
+static inline uint64_t fix_time_to_velocity(fix_vel dv, fix_acc a) {
+	return fix_div_shift(dv, a, 16);
+}
+
+// microseconds needed to cover p (>= 0) while moving at a constant velocity v (> 0)
+
+static inline uint64_t fix_time_to_travel(fix_pos p, fix_vel v) {
+	return (uint64_t)p / (uint64_t)v;
+}
+
+// integer square root, rounded down
+
+static inline uint32_t fix_isqrt(uint64_t x) {
+	uint64_t root = 0;
+	uint64_t bit = 1ULL << 62;
+	while (bit > x) {
+		bit >>= 2;
+	}
+	while (bit != 0) {
+		if (x >= root + bit) {
+			x -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return root;
+}
+
+// microseconds needed to cover p (>= 0) from a standstill at acceleration a (> 0): sqrt(2 * p / a)
+
+static inline uint64_t fix_time_to_distance(fix_pos p, fix_acc a) {
+	return fix_isqrt(fix_div_shift(p, a, 17));
+}
+
+// whole steps in a position, truncated toward zero the same way a float to int cast would
+
+static inline int fix_to_steps(fix_pos p) {
+	return p / FIX_POS_ONE_STEP;
+}
+
+#endif /* INC_FIXED_H_ */
@@ -1,6 +1,18 @@
 #ifndef INC_MAIN_REAL_H_
 #define INC_MAIN_REAL_H_
 
+// loop period in microseconds
+// faster loops mean we can output more steps per second which leads to a faster top speed,
+// but also requires more processing power.
+// set this so that last_idle_time never drops too close to zero
+#define DT_US 100
+
 void main_real();
 
+int get_actual_position_steps();
+int get_last_idle_time();
+
+// loop iterations in which steps were due faster than the motor could be stepped
+unsigned long get_rate_limited_ticks();
+
 #endif /* INC_MAIN_REAL_H_ */
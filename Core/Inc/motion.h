@@ -2,13 +2,47 @@
 #define MOTION_H
 
 #include "command_runner.h"
+#include "fixed.h"
 #include <stdbool.h>
 
-void motion_command(motionCommand* command);
+// a planned move.  motion_command() fills this in when a tp= or tv= command arrives, so the per-tick
+// path only has to find the current phase and evaluate one polynomial.  times are relative to t0.
+//
+// position mode: accelerate at a until t1 (reaching v1 at p1), cruise at v until t2 (reaching p2),
+//                then decelerate until t3.
+// velocity mode: accelerate at a until t1 (reaching p1), then hold at v.
+
+typedef struct motionSegment {
+	uint64_t t1;
+	uint64_t t2;
+	uint64_t t3;
+	fix_acc a;
+	fix_vel v;
+	fix_vel v1;
+	fix_pos p1;
+	fix_pos p2;
+} motionSegment;
+
+// which part of the move the planner is in, for telemetry
+
+typedef enum motionPhase {
+	MOTION_PHASE_REST,    // holding still
+	MOTION_PHASE_ACCEL,   // position mode, speeding up
+	MOTION_PHASE_CRUISE,  // position mode at full speed, or velocity mode at the target velocity
+	MOTION_PHASE_DECEL,   // position mode, slowing down to the target
+	MOTION_PHASE_RAMP,    // velocity mode, changing to the target velocity
+	MOTION_PHASE_STOP,    // ramping to a stop before starting a position move
+} motionPhase;
+
+void motion_init();
 int motion_get_position_target_steps();
+int motion_get_position_target_steps_at(uint64_t now);
+fix_pos motion_get_position_target_at(uint64_t now);
 int motion_get_position_target_steps_position_mode();
 int motion_get_position_target_steps_velocity_mode();
 bool motion_get_enabled();
-int sign(double value);
+fix_pos motion_get_commanded_position();
+fix_vel motion_get_commanded_velocity();
+motionPhase motion_get_phase();
 
 #endif
@@ -0,0 +1,68 @@
+#ifndef INC_PROFILE_H_
+#define INC_PROFILE_H_
+
+#include "main.h"
+#include <stdbool.h>
+
+// cycle-accurate profiling of the main loop and the step engine, using the core's DWT cycle counter.
+// each section keeps its min, max and mean time in CPU cycles (64 per microsecond).
+// comment this out to compile all the markers away.
+#define PROFILE
+
+typedef enum profileSection {
+	PROFILE_POLL,     // reading and running commands
+	PROFILE_PLAN,     // evaluating the motion plan and timing steps
+	PROFILE_STEP,     // handing steps to the hardware
+	PROFILE_LOOP,     // everything the main loop does in one iteration, not counting its wait
+	PROFILE_REFILL,   // the step engine's DMA interrupt
+	PROFILE_SECTIONS
+} profileSection;
+
+typedef struct profileStats {
+	uint32_t start;
+	uint32_t min;
+	uint32_t max;
+	uint32_t count;
+	uint64_t total;
+} profileStats;
+
+extern profileStats profile_stats[PROFILE_SECTIONS];
+
+void profile_init();
+
+void profile_reset();
+
+// the raw cycle counter, for anything that needs finer timing than uptime()
+
+static inline uint32_t profile_cycles() {
+	return DWT->CYCCNT;
+}
+
+#ifdef PROFILE
+
+static inline void profile_begin(profileSection section) {
+	profile_stats[section].start = DWT->CYCCNT;
+}
+
+static inline void profile_end(profileSection section) {
+	profileStats* stats = &profile_stats[section];
+	uint32_t cycles = DWT->CYCCNT - stats->start;
+	if (cycles < stats->min) {
+		stats->min = cycles;
+	}
+	if (cycles > stats->max) {
+		stats->max = cycles;
+	}
+	stats->count++;
+	stats->total += cycles;
+}
+
+#else
+
+static inline void profile_begin(profileSection section) {}
+
+static inline void profile_end(profileSection section) {}
+
+#endif
+
+#endif /* INC_PROFILE_H_ */
@@ -0,0 +1,51 @@
+#ifndef INC_SERIAL_H_
+#define INC_SERIAL_H_
+
+#include "main.h"
+#include <stdbool.h>
+
+// priority of the USART1 and its DMA channel interrupts, as set up in Stepper.ioc
+#define SERIAL_IRQ_PRIORITY 8
+
+// size of the outgoing queue.  a message that doesn't fit is dropped whole.
+#define SERIAL_TX_LEN 512
+
+// size of the circular receive buffer the DMA writes into.  the main loop drains it at least every time
+// the DMA gets halfway around, so half of it must hold more than arrives in one loop period.
+#define SERIAL_RX_LEN 512
+
+// baud rate at power up, and the one we fall back to if the link is lost after a change
+#define SERIAL_DEFAULT_BAUD 9600
+
+// after switching baud rates, a command has to arrive at the new rate within this long, or we go back
+// to the old one
+#define SERIAL_CONFIRM_US 2000000
+
+// largest error in the actual baud rate that we accept, in parts per thousand
+#define SERIAL_MAX_BAUD_ERROR 15
+
+void serial_init(UART_HandleTypeDef* _huart);
+
+bool serial_write(const char* data, unsigned int len);
+
+bool serial_print(const char* text);
+
+uint8_t* serial_reserve(unsigned int len);
+
+void serial_commit(uint8_t* data, unsigned int len);
+
+bool serial_read_char(char* c);
+
+// returns true once after received data has been lost, so whatever was half read can be thrown away
+bool serial_rx_lost();
+
+// number of times the main loop fell a whole receive buffer behind and the unread data was dropped
+unsigned long get_serial_rx_overruns();
+
+void serial_poll();
+
+bool serial_set_baud(uint32_t baud);
+
+void serial_confirm_baud();
+
+#endif /* INC_SERIAL_H_ */
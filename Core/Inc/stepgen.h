@@ -0,0 +1,47 @@
+#ifndef INC_STEPGEN_H_
+#define INC_STEPGEN_H_
+
+#include "main.h"
+
+// step and direction signals are timed by TIM1 and fed by DMA from a ring of precomputed step periods,
+// so there's no CPU work per step and no limit of one step per main loop iteration.
+// comment this out to step from the main loop instead (see stepper.c).
+#define STEPGEN_DMA
+
+// TIM1 runs at 8 MHz in this mode
+#define STEPGEN_TICKS_PER_US 8
+
+// the step pulse is at the end of each period, and the direction pin changes at the start of it.
+// the driver needs pulses of at least 2.5 us, and direction must lead the pulse by at least 5 us.
+#define STEPGEN_PULSE_TICKS (3 * STEPGEN_TICKS_PER_US)
+#define STEPGEN_DIR_SETUP_TICKS (5 * STEPGEN_TICKS_PER_US)
+#define STEPGEN_MIN_PERIOD_TICKS (STEPGEN_PULSE_TICKS + STEPGEN_DIR_SETUP_TICKS)
+
+// the planner is sampled this often.  the exact time of each step inside a sample is found by
+// interpolating between the samples, which is accurate to well under a tick at this spacing.
+#define STEPGEN_SAMPLE_TICKS (50 * STEPGEN_TICKS_PER_US)
+
+// the main loop plans steps into blocks of segments, each a run of equal step periods.  there are two
+// blocks: the DMA interrupt plays one while the main loop fills the other.  a block is handed over once
+// it covers this much time or runs out of segments, so new commands take effect within a few blocks.
+// either way a block must outlast half the ring, so the interrupt never needs both blocks at once.
+#define STEPGEN_BLOCK_TICKS (2000 * STEPGEN_TICKS_PER_US)
+#define STEPGEN_BLOCK_LEN 64
+
+// longest period the DMA interrupt puts in the ring.  longer ones are split up, which keeps the time
+// between the interrupt and the hardware playing what it wrote short at any step rate.
+#define STEPGEN_SLOT_TICKS (50 * STEPGEN_TICKS_PER_US)
+
+// number of periods in the ring.  the DMA interrupt refills half of it at a time, so at the highest
+// step rate, half the ring must outlast the interrupt's own run time by a wide margin.
+#define STEPGEN_RING_LEN 64
+
+void stepgen_init(TIM_HandleTypeDef* _htim);
+
+void stepgen_fill();
+
+int stepgen_get_position();
+
+unsigned long stepgen_get_rate_limited_steps();
+
+#endif /* INC_STEPGEN_H_ */
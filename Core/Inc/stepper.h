@@ -4,14 +4,44 @@
 #include "main.h"
 #include <stdbool.h>
 
+// step pulses are generated in hardware by TIM1 channel 1 on PA8.
+// comment this out to go back to bit-banging PA15.
+#define STEPPER_PULSE_TIMER
+
+// step pulse width in timer ticks (1 us each).  the driver needs at least 2.5 us.
+#define STEPPER_PULSE_TICKS 4
+
+// the direction signal must lead the pulse by at least 5 us
+#define STEPPER_DIRECTION_SETUP_US 5
+
+// shortest time between the starts of two pulses in a burst, in timer ticks.  a pulse rises
+// STEPPER_PULSE_TICKS before the end of its period, and a burst can start right after a direction
+// change, so the part of the period before the pulse has to be at least STEPPER_DIRECTION_SETUP_US.
+#define STEPPER_MIN_PERIOD_TICKS (STEPPER_DIRECTION_SETUP_US + STEPPER_PULSE_TICKS)
+
+// time the driver needs after the enable pin changes before it takes steps
+#define STEPPER_ENABLE_SETTLE_US 100
+
+void stepper_init(TIM_HandleTypeDef* _htim);
+
 void stepper_enable();
 
 void stepper_disable();
 
 void stepper_direction(bool forward);
 
+// when the last enable or direction change will have settled, in uptime() microseconds
+uint64_t stepper_get_ready_time();
+
+bool stepper_ready();
+
 void stepper_step();
 
-void stepper_step_direction(bool forward);
+// step in the given direction, unless the driver isn't ready for it yet.  returns whether it stepped.
+bool stepper_step_direction(bool forward);
+
+// start count steps in the given direction, spread evenly over the next window_ticks.  fewer steps go
+// out if they don't fit; returns how many did.
+int stepper_step_burst(bool forward, int count, unsigned int window_ticks);
 
 #endif
@@ -0,0 +1,31 @@
+#ifndef INC_TELEMETRY_H_
+#define INC_TELEMETRY_H_
+
+#include <stdint.h>
+
+// streamed telemetry records start with this byte, which is different from a command frame's
+#define TELEMETRY_SYNC 0x5a
+
+// the highest streaming rate, once per main loop iteration
+#define TELEMETRY_MAX_RATE 10000
+
+// one streamed record.  all fields are little-endian.  at 23 bytes, a rate of 1000 per second needs at
+// least 230400 baud.
+
+typedef struct __attribute__((packed)) telemetryRecord {
+	uint8_t sync;        // TELEMETRY_SYNC
+	uint8_t sequence;    // counts up by one per record, so the host can spot drops
+	uint32_t time;       // uptime in microseconds, low 32 bits
+	int32_t target;      // commanded position, steps
+	int32_t actual;      // actual position, steps
+	int32_t velocity;    // commanded velocity, steps per second
+	uint8_t phase;       // motionPhase
+	int16_t idle;        // main loop idle time, microseconds
+	uint16_t crc;        // CRC-16/CCITT-FALSE of everything after sync, as for command frames
+} telemetryRecord;
+
+void telemetry_init();
+
+void telemetry_poll(uint64_t now);
+
+#endif /* INC_TELEMETRY_H_ */
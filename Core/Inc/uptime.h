@@ -4,11 +4,9 @@
 #include "main.h"
 #include <stdbool.h>
 
-void uptime_int();
+void uptime_init(TIM_HandleTypeDef* _htim_low, TIM_HandleTypeDef* _htim_high);
 
-void uptime_init(TIM_HandleTypeDef* _htim);
-
-unsigned long uptime();
+uint64_t uptime();
 
 void sleep(unsigned int duration);
 
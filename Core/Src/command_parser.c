@@ -4,7 +4,6 @@
 // xy=-123.4567890
 // They are always followed by a newline or return character.
 
-#include <stdlib.h>
 #include <string.h>
 
 enum CommandState {
@@ -19,17 +18,91 @@ enum CommandState state = RESET;
 char command[3] = {0};
 char value[32] = {0};
 int value_len = 0;
-char last_command[3] = {0};
-double last_value_dbl = 0;
-bool last_command_ready = false;
 
-// This system expected to be accessed from two directions:
-// 1. The serial port calls command_parse_char for each character it receives.
-// 2. The main application polls get_command_received(), and calls get_command() and get_value() whenever a new command is ready.
+// The queue of parsed commands, a plain FIFO.  The parser adds at queue_head and get_command() takes from
+// queue_tail.  The command runner parses everything that has arrived before it takes any commands off, so
+// a burst of commands waits here in order.
+//
+// Both ends run in the main loop, one after the other, so nothing here is safe against being interrupted
+// part way.  Don't call command_parse_char() from the serial receive interrupt: that would need the
+// indexes made volatile and the slot written before queue_head moves on, with barriers to match.
+
+motionCommand queue[COMMAND_QUEUE_LEN];
+unsigned int queue_head = 0;
+unsigned int queue_tail = 0;
+unsigned int queue_max_depth = 0;
+unsigned long queue_overflows = 0;
+
+unsigned int get_command_queue_max_depth() { return queue_max_depth; }
+unsigned long get_command_overflows() { return queue_overflows; }
+
+static void command_queue_push(const char* command, int64_t value) {
+	unsigned int head = queue_head;
+	unsigned int depth = head - queue_tail;
+	if (depth >= COMMAND_QUEUE_LEN) {
+		queue_overflows++;
+		return;
+	}
+	motionCommand* slot = &queue[head % COMMAND_QUEUE_LEN];
+	memcpy(slot->command, command, sizeof(slot->command));
+	slot->value = value;
+	queue_head = head + 1;
+	if (depth + 1 > queue_max_depth) {
+		queue_max_depth = depth + 1;
+	}
+}
 
-bool get_command_received() { bool value = last_command_ready; last_command_ready = false; return value; }
-char* get_command() { return last_command; }
-double get_value() { return last_value_dbl; }
+bool get_command(motionCommand* command) {
+	unsigned int tail = queue_tail;
+	if (tail == queue_head) {
+		return false;
+	}
+	*command = queue[tail % COMMAND_QUEUE_LEN];
+	queue_tail = tail + 1;
+	return true;
+}
+
+// This converts a decimal number of the form -123.456 into millionths.  It takes a bounded time, doesn't
+// allocate, and doesn't need floating point.  Like strtod, it stops at the first character that doesn't
+// fit the form.  Digits past the sixth decimal place are dropped, and whole parts too large to fit
+// saturate at COMMAND_WHOLE_MAX.
+
+int64_t command_parse_decimal(const char* text, int len) {
+	int i = 0;
+	bool negative = false;
+	if (i < len && text[i] == '-') {
+		negative = true;
+		i++;
+	}
+
+	int64_t whole = 0;
+	for (; i < len && text[i] >= '0' && text[i] <= '9'; i++) {
+		if (whole <= COMMAND_WHOLE_MAX) {
+			whole = whole * 10 + (text[i] - '0');
+		}
+	}
+	if (whole > COMMAND_WHOLE_MAX) {
+		whole = COMMAND_WHOLE_MAX;
+	}
+
+	int64_t fraction = 0;
+	int64_t place = COMMAND_VALUE_SCALE;
+	if (i < len && text[i] == '.') {
+		for (i++; i < len && text[i] >= '0' && text[i] <= '9'; i++) {
+			place /= 10;
+			fraction += (text[i] - '0') * place;
+		}
+	}
+
+	int64_t value = whole * COMMAND_VALUE_SCALE + fraction;
+	return negative ? -value : value;
+}
+
+// This throws away a partly received command, after some of the characters were lost
+
+void command_parse_reset() {
+	state = RESET;
+}
 
 // This is the state machine that does the character-by-character parsing
 
@@ -81,10 +154,7 @@ void command_parse_char(char c) {
                 }
             }
             else if (c == '\r' || c == '\n') {
-                memcpy(last_command, command, sizeof(command));
-                char* eptr;
-                last_value_dbl = strtod(value, &eptr);
-                last_command_ready = true;
+                command_queue_push(command, command_parse_decimal(value, value_len));
                 state = RESET;
             }
             else {
@@ -1,39 +1,149 @@
 #include "command_runner.h"
 #include "command_parser.h"
+#include "command_frame.h"
+#include "command_table.h"
+#include "serial.h"
 
+#include <stdio.h>
 #include <string.h>
 
-// this wraps the real command parser (command_parser.c) by adding an error-checking mechanism.
-// since there are no checksums or other error-detection mechanisms in this protocol, we implement
-// a crude one by requiring each command to be sent twice.  The command is only executed when
-// received the second time with identical contents.
+// this reads commands from the serial port in one of two protocols, chosen at run time with pm=:
 //
-// this should be called frequently by the main loop.
+// pm=0 - ascii (command_parser.c).  since there are no checksums or other error-detection mechanisms in
+//        this protocol, we implement a crude one by requiring each command to be sent twice.  The command
+//        is only executed when received the second time with identical contents.
+// pm=1 - binary frames (command_frame.c).  each frame has a CRC, so each command is sent once.  frames
+//        are numbered, and are taken strictly in order and acknowledged, so the host can keep a window
+//        of them in flight (see command_frame.h).  the first frame after pm=1 sets the numbering.
+//
+// this should be called frequently by the main loop.  it reads whatever has arrived on the serial port
+// and stops as soon as a command is confirmed, so call it again until it returns false.
 //
 // when it returns true, a command is available and has been stored in the motionCommand pointer parameter
 
+bool binary_protocol = false;
+bool have_sequence = false;
+uint8_t expected_sequence = 0;
+bool nak_sent = false;
+unsigned long last_frame_errors = 0;
+
+char command_a[3] = {0};
+int64_t value_a = 0;
+
+char command_b[3] = {0};
+int64_t value_b = 0;
+
+static void send_frame_reply(uint8_t type, uint8_t sequence) {
+    uint8_t* reply = serial_reserve(COMMAND_REPLY_LEN);
+    if (reply == 0) {
+        return;
+    }
+    reply[0] = COMMAND_REPLY_SYNC;
+    reply[1] = type;
+    reply[2] = sequence;
+    uint16_t crc = command_frame_crc(reply + 1, 2);
+    reply[3] = crc;
+    reply[4] = crc >> 8;
+    serial_commit(reply, COMMAND_REPLY_LEN);
+}
+
+// ask for everything from the expected frame again, once per gap.  if the NAK itself is lost, the host
+// times out and resends anyway.
+
+static void send_frame_nak() {
+    if (have_sequence && !nak_sent) {
+        nak_sent = true;
+        send_frame_reply(COMMAND_REPLY_NAK, expected_sequence);
+    }
+}
+
+static bool poll_new_frame(motionCommand* command) {
+
+    char c;
+    while (serial_read_char(&c)) {
+
+        if (!command_frame_char((uint8_t)c)) {
+            if (get_frame_errors() != last_frame_errors) {
+                last_frame_errors = get_frame_errors();
+                send_frame_nak();
+            }
+            continue;
+        }
+
+        uint8_t sequence = get_frame_sequence();
+        if (!have_sequence) {
+            have_sequence = true;
+            expected_sequence = sequence;
+        }
+
+        int8_t ahead = sequence - expected_sequence;
+        if (ahead < 0) {
+            // a retransmission of something we already have, so the ACK for it must have been lost
+            send_frame_reply(COMMAND_REPLY_ACK, expected_sequence - 1);
+            continue;
+        }
+        if (ahead > 0) {
+            // one or more frames went missing in between
+            send_frame_nak();
+            continue;
+        }
+
+        expected_sequence++;
+        nak_sent = false;
+        send_frame_reply(COMMAND_REPLY_ACK, sequence);
+
+        command->command[0] = get_frame_command()[0];
+        command->command[1] = get_frame_command()[1];
+        command->value = get_frame_value();
+        serial_confirm_baud();
+        return true;
+
+    }
+
+    return false;
+
+}
+
 bool poll_new_command(motionCommand* command) {
 
-	static char command_a[3] = {0};
-	static double value_a = 0;
+	// if the serial port lost some data, whatever command was coming in is incomplete.  in binary mode,
+	// the frame that was lost has to be asked for again.
+	if (serial_rx_lost()) {
+		command_parse_reset();
+		command_frame_reset();
+		if (binary_protocol) {
+			send_frame_nak();
+		}
+	}
+
+	if (binary_protocol) {
+		return poll_new_frame(command);
+	}
 
-	static char command_b[3] = {0};
-	static double value_b = 0;
+    // parse everything that has arrived first, so a burst of commands queues up in the order it came in
+    char c;
+    while (serial_read_char(&c)) {
+        command_parse_char(c);
+    }
 
     // as an error-catching method we want commands to be repeated twice with identical content before executing them.
+    // take the parsed commands in order, and stop at the first one that's confirmed.
 
-    if (get_command_received()) {
+    motionCommand parsed;
+    while (get_command(&parsed)) {
 
         memcpy(command_a, command_b, sizeof(command_a));
         value_a = value_b;
 
-        memcpy(command_b, get_command(), sizeof(command_b));
-        value_b = get_value();
+        memcpy(command_b, parsed.command, sizeof(command_b));
+        value_b = parsed.value;
 
         if (command_a[0] == command_b[0] && command_a[1] == command_b[1] && value_a == value_b) {
         	command->command[0] = command_a[0];
         	command->command[1] = command_a[1];
         	command->value = value_a;
+        	// a good command means the serial link works at its current baud rate
+        	serial_confirm_baud();
         	return true;
         }
 
@@ -42,3 +152,27 @@ bool poll_new_command(motionCommand* command) {
     return false;
 
 }
+
+// pm=0 selects the ascii protocol and pm=1 selects binary frames.  the reply is always in ascii.  bytes
+// that arrived along with pm=1 have already been parsed as ascii, so the host has to wait for the reply
+// before it sends frames.
+
+static void command_runner_command(int64_t value) {
+	binary_protocol = value == COMMAND_VALUE(1);
+	have_sequence = false;
+	nak_sent = false;
+	last_frame_errors = get_frame_errors();
+	// an ascii command must be sent twice again after switching back
+	bzero(command_b, sizeof(command_b));
+	char reply[8];
+	snprintf(reply, sizeof(reply), "pm=%d\n", binary_protocol ? 1 : 0);
+	serial_print(reply);
+}
+
+static const commandEntry runner_commands[] = {
+	{ "pm", COMMAND_VALUE(0), COMMAND_VALUE(1), "", command_runner_command },
+};
+
+void command_runner_init() {
+	command_register(runner_commands, sizeof(runner_commands) / sizeof(runner_commands[0]));
+}
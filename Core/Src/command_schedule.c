@@ -0,0 +1,91 @@
+#include "command_schedule.h"
+#include "command_table.h"
+
+#include <string.h>
+
+// time-tagged commands
+//
+// at=X makes the next command run at uptime X, in seconds (the same clock as the t= in telemetry
+// replies), instead of as soon as it arrives.  controllers that share a clock reference can then start
+// moves together, however the commands reached each of them.
+//
+// the motion planner takes waiting motion commands off here as it works forward in time, and runs each
+// one at exactly its time, so a move starts from where the plan was at that moment and not wherever the
+// main loop happened to be.  a command whose time has already passed runs as soon as the planner next
+// runs.  the step engine plans a few milliseconds ahead, so a time has to be at least that far off to be
+// met exactly.
+//
+// the planner runs ahead of the clock, so anything that isn't part of the plan (en=, the queries, ts=,
+// br=, pm=, ...) would run early from there.  those are taken off by the main loop instead, once uptime()
+// reaches their time.
+//
+// the waiting commands are kept sorted by time, soonest first.  if they're full, the command is
+// dropped and counted (s= in the qc= reply).
+//
+// binary frames carry values in thousandths, so at= from a frame has millisecond resolution.
+
+typedef struct scheduledCommand {
+	uint64_t time;
+	motionCommand command;
+} scheduledCommand;
+
+scheduledCommand schedule[COMMAND_SCHEDULE_LEN];
+int schedule_len = 0;
+unsigned long schedule_overflows = 0;
+
+bool at_pending = false;
+uint64_t at_time = 0;
+
+unsigned long get_command_schedule_overflows() { return schedule_overflows; }
+
+bool command_schedule(motionCommand* command) {
+	if (!at_pending || (command->command[0] == 'a' && command->command[1] == 't')) {
+		return false;
+	}
+	at_pending = false;
+
+	if (schedule_len == COMMAND_SCHEDULE_LEN) {
+		schedule_overflows++;
+		return true;
+	}
+
+	// commands due at the same time stay in the order they arrived
+	int i = schedule_len;
+	while (i > 0 && schedule[i - 1].time > at_time) {
+		schedule[i] = schedule[i - 1];
+		i--;
+	}
+	schedule[i].time = at_time;
+	schedule[i].command = *command;
+	schedule_len++;
+	return true;
+}
+
+bool command_schedule_next(uint64_t now, bool planned, motionCommand* command, uint64_t* time) {
+	for (int i = 0; i < schedule_len && schedule[i].time <= now; i++) {
+		if (command_planned(&schedule[i].command) != planned) {
+			continue;
+		}
+		*command = schedule[i].command;
+		*time = schedule[i].time;
+		schedule_len--;
+		memmove(&schedule[i], &schedule[i + 1], (schedule_len - i) * sizeof(scheduledCommand));
+		return true;
+	}
+	return false;
+}
+
+// the value is in millionths of a second, which is already uptime()'s microseconds
+
+static void command_schedule_at(int64_t value) {
+	at_pending = true;
+	at_time = value;
+}
+
+static const commandEntry schedule_commands[] = {
+	{ "at", COMMAND_VALUE(0), COMMAND_VALUE(999999999), "s", command_schedule_at },
+};
+
+void command_schedule_init() {
+	command_register(schedule_commands, sizeof(schedule_commands) / sizeof(schedule_commands[0]));
+}
@@ -0,0 +1,112 @@
+#include "command_table.h"
+#include "serial.h"
+
+#include <stdio.h>
+
+// registered commands, hashed by their two letters with linear probing.  the entries themselves live in
+// each module's constant table, so this only holds pointers.
+
+const commandEntry* command_table[COMMAND_TABLE_LEN] = {0};
+unsigned long command_rejected = 0;
+
+unsigned long get_command_rejected() { return command_rejected; }
+
+static bool command_letter(char c) {
+	return c >= 'a' && c <= 'z';
+}
+
+static unsigned int command_hash(const char* command) {
+	return ((unsigned int)(command[0] - 'a') * 26 + (unsigned int)(command[1] - 'a')) % COMMAND_TABLE_LEN;
+}
+
+// the slot for a command, or 0 if it can't be in the table.  codes come straight off the serial port, so
+// anything that isn't two lowercase letters is turned away here before it's hashed.
+
+static const commandEntry** command_find(const char* command) {
+	if (!command_letter(command[0]) || !command_letter(command[1])) {
+		return 0;
+	}
+	unsigned int slot = command_hash(command);
+	for (int i = 0; i < COMMAND_TABLE_LEN; i++) {
+		const commandEntry** entry = &command_table[slot];
+		if (*entry == 0 || ((*entry)->command[0] == command[0] && (*entry)->command[1] == command[1])) {
+			return entry;
+		}
+		slot = (slot + 1) % COMMAND_TABLE_LEN;
+	}
+	return 0;
+}
+
+// returns false if the table is full or a command was already registered.  commands before the failing
+// one stay registered.
+
+bool command_register(const commandEntry* entries, int count) {
+	for (int i = 0; i < count; i++) {
+		const commandEntry** entry = command_find(entries[i].command);
+		if (entry == 0 || *entry != 0) {
+			return false;
+		}
+		*entry = &entries[i];
+	}
+	return true;
+}
+
+bool command_dispatch(motionCommand* command) {
+	const commandEntry** entry = command_find(command->command);
+	if (entry == 0 || *entry == 0 || command->value < (*entry)->min || command->value > (*entry)->max) {
+		command_rejected++;
+		return false;
+	}
+	(*entry)->handler(command->value);
+	return true;
+}
+
+// writes a command value the way it would be typed, with as many decimal places as it needs
+
+static void command_format_value(char* text, int size, int64_t value) {
+	uint64_t magnitude = value < 0 ? -value : value;
+	long whole = magnitude / COMMAND_VALUE_SCALE;
+	long fraction = magnitude % COMMAND_VALUE_SCALE;
+	int len = snprintf(text, size, "%s%ld.%06ld", value < 0 ? "-" : "", whole, fraction);
+	if (len >= size) {
+		len = size - 1;
+	}
+	while (len > 0 && text[len - 1] == '0') {
+		len--;
+	}
+	if (len > 0 && text[len - 1] == '.') {
+		len--;
+	}
+	text[len] = 0;
+}
+
+bool command_planned(const motionCommand* command) {
+	const commandEntry** entry = command_find(command->command);
+	return entry != 0 && *entry != 0 && (*entry)->planned;
+}
+
+// hl=X - list the registered commands with their ranges and units
+
+static void command_list(int64_t value) {
+	char line[64];
+	char min[24];
+	char max[24];
+	for (int i = 0; i < COMMAND_TABLE_LEN; i++) {
+		const commandEntry* entry = command_table[i];
+		if (entry == 0) {
+			continue;
+		}
+		command_format_value(min, sizeof(min), entry->min);
+		command_format_value(max, sizeof(max), entry->max);
+		int len = snprintf(line, sizeof(line), "%s %s..%s %s\n", entry->command, min, max, entry->units);
+		serial_write(line, len < (int)sizeof(line) ? len : (int)sizeof(line) - 1);
+	}
+}
+
+static const commandEntry table_commands[] = {
+	{ "hl", COMMAND_VALUE(0), COMMAND_VALUE(0), "", command_list },
+};
+
+void command_table_init() {
+	command_register(table_commands, sizeof(table_commands) / sizeof(table_commands[0]));
+}
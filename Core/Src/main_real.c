@@ -1,27 +1,46 @@
 #include "main_real.h"
 #include "stepper.h"
+#include "stepgen.h"
 #include "uptime.h"
 #include "command_runner.h"
+#include "command_table.h"
+#include "command_schedule.h"
 #include "motion.h"
-
-// loop period in microseconds
-// faster loops mean we can output more steps per second which leads to a faster top speed,
-// but also requires more processing power.
-// set this so that last_idle_time never drops too close to zero
-#define DT_US 100
+#include "profile.h"
+#include "serial.h"
+#include "telemetry.h"
 
 int last_idle_time = 0;
-unsigned long next_start_time = 0;
+
+// loop iterations in which the motor couldn't keep up with the motion plan, because more steps were due
+// than fit in one loop period (or in the step engine's minimum period between steps).  with the DMA step
+// engine it's the iterations in which stepgen planned a step later than wanted, which is up to two
+// blocks before that step plays, not when it goes out.  reported by qc=.
+unsigned long rate_limited_ticks = 0;
+unsigned long last_rate_limited_steps = 0;
+uint64_t next_start_time = 0;
 int actual_position_steps = 0;
 int immediate_position_steps = 0;
 bool last_enabled = false;
 
 motionCommand new_command = {0};
 
+int get_actual_position_steps() { return actual_position_steps; }
+int get_last_idle_time() { return last_idle_time; }
+unsigned long get_rate_limited_ticks() { return rate_limited_ticks; }
+
 // This needs to be compiled with some level of optimization, or it's on the edge of not making timing.
+// make -C Host budget measures how close to the edge each command and motion phase takes it.
 
 void main_real() {
 
+	// set up the command table and the motion planner before any commands arrive
+	command_table_init();
+	command_runner_init();
+	command_schedule_init();
+	telemetry_init();
+	motion_init();
+
 	// default to the motor being on
 	stepper_enable();
 
@@ -29,14 +48,27 @@ void main_real() {
 
 		// run at a constant loop rate defined by DT_US
 		next_start_time += DT_US;
-		last_idle_time = (long)next_start_time - (long)uptime();
+		last_idle_time = (int64_t)(next_start_time - uptime());
 		while (uptime() < next_start_time) ;
+		profile_begin(PROFILE_LOOP);
 
 		// read any new commands from the serial port
-		if(poll_new_command(&new_command)) {
-			motion_command(&new_command);
+		profile_begin(PROFILE_POLL);
+		while (poll_new_command(&new_command)) {
+			if (!command_schedule(&new_command)) {
+				command_dispatch(&new_command);
+			}
 		}
 
+		// the planner runs time-tagged motion commands itself.  the others run here, once their time comes.
+		uint64_t scheduled_time;
+		while (command_schedule_next(uptime(), false, &new_command, &scheduled_time)) {
+			command_dispatch(&new_command);
+		}
+
+		serial_poll();
+		profile_end(PROFILE_POLL);
+
 		// enable/disable the motor if necessary
 		bool enabled = motion_get_enabled();
 		if (enabled && !last_enabled) {
@@ -47,19 +79,55 @@ void main_real() {
 		}
 		last_enabled = enabled;
 
+#ifdef STEPGEN_DMA
+
+		// plan the next block of steps if the step engine has handed one back.  its DMA interrupt plays
+		// them out on its own, so how long this loop takes doesn't move any step.
+		profile_begin(PROFILE_PLAN);
+		stepgen_fill();
+		profile_end(PROFILE_PLAN);
+
+		profile_begin(PROFILE_STEP);
+		actual_position_steps = stepgen_get_position();
+
+		unsigned long rate_limited_steps = stepgen_get_rate_limited_steps();
+		if (rate_limited_steps != last_rate_limited_steps) {
+			rate_limited_ticks++;
+		}
+		last_rate_limited_steps = rate_limited_steps;
+		profile_end(PROFILE_STEP);
+
+#else
+
 		// update the motion plan since some time has passed, and see what step we should be on
+		profile_begin(PROFILE_PLAN);
 		immediate_position_steps = motion_get_position_target_steps();
+		profile_end(PROFILE_PLAN);
 
-		// send one step to the stepper motor if necessary
+		// send the steps we're behind by, spread evenly over what's left of this loop period.  the burst has
+		// to be over before the next iteration starts, or that one finds the timer busy and sends nothing.
+		profile_begin(PROFILE_STEP);
 		int position_error_steps = immediate_position_steps - actual_position_steps;
-		if (position_error_steps > 0) {
-			stepper_step_direction(true);
-			actual_position_steps++;
-		}
-		if (position_error_steps < 0) {
-			stepper_step_direction(false);
-			actual_position_steps--;
+		if (position_error_steps != 0) {
+			bool forward = position_error_steps > 0;
+			int wanted = forward ? position_error_steps : -position_error_steps;
+			uint64_t now = uptime();
+			uint64_t next_tick = next_start_time + DT_US;
+			unsigned int window_us = next_tick > now ? next_tick - now : 0;
+			int sent = stepper_step_burst(forward, wanted, window_us);
+			actual_position_steps += forward ? sent : -sent;
+			if (sent < wanted) {
+				rate_limited_ticks++;
+			}
 		}
+		profile_end(PROFILE_STEP);
+
+#endif
+
+		// stream telemetry, if it's been asked for
+		telemetry_poll(next_start_time);
+
+		profile_end(PROFILE_LOOP);
 
 	}
 }
@@ -1,6 +1,8 @@
 #include "motion.h"
 #include "uptime.h"
-#include <math.h>
+#include "fixed.h"
+#include "command_table.h"
+#include "command_schedule.h"
 
 // default values for velocity limit, acceleration limit, and steps per revolution.
 // these can be overridden by commands when running.
@@ -8,12 +10,21 @@ float vl = 90;
 float al = 10;
 int steps_per_rev = 25000;
 
+// the velocity and acceleration limits converted to the step domain.
+// these are what the planner actually uses, and get updated whenever vl, al, or steps_per_rev change.
+fix_vel vl_fx = 0;
+fix_acc al_fx = 0;
+
 // initial and target (final) positions, velocities, and times
-double pf = 0;
-double vf = 0;
-unsigned long t0 = 0;
-double v0 = 0;
-double p0 = 0;
+fix_pos pf = 0;
+fix_vel vf = 0;
+uint64_t t0 = 0;
+fix_vel v0 = 0;
+fix_pos p0 = 0;
+
+// the time the planner was last evaluated at.  new moves start from here, so they pick up exactly
+// where the last evaluated position and velocity left off, even if that was a little in the future.
+uint64_t t_now = 0;
 
 // if we're current in position target mode (if not then we're in velocity target mode)
 bool target_p_mode = true;
@@ -26,15 +37,106 @@ bool stop_needed = false;
 bool enabled = true;
 
 // the commanded values for p and v that we will calculate
-float v_cmd = 0;
-float p_cmd = 0;
+fix_vel v_cmd = 0;
+fix_pos p_cmd = 0;
+
+// the current move, planned once when the command arrives so the per-tick path only has to evaluate it
+motionSegment segment = {0};
+motionPhase phase = MOTION_PHASE_REST;
+
+// unit conversions from the degree-based command values into the step domain.
+// these use floating point, so they're only done when a command arrives, never in the per-tick path.
+
+static fix_pos deg_to_fix_pos(double deg) {
+	return deg / 360.0 * steps_per_rev * 4294967296.0;
+}
+
+static fix_vel deg_to_fix_vel(double deg_per_sec) {
+	return deg_per_sec / 360.0 * steps_per_rev / 1e6 * 4294967296.0;
+}
+
+static fix_acc deg_to_fix_acc(double deg_per_sec2) {
+	return deg_per_sec2 / 360.0 * steps_per_rev / 1e12 * 281474976710656.0;
+}
+
+static void motion_update_limits() {
+	vl_fx = deg_to_fix_vel(vl);
+	al_fx = deg_to_fix_acc(al);
+	// the planner divides by these, so never let them reach zero
+	if (vl_fx < 1) vl_fx = 1;
+	if (al_fx < 1) al_fx = 1;
+}
 
-int sign(double value) {
-	return value > 0 ? 1 : -1;
+// the planner state is kept in steps, so changing steps_per_rev rescales it to keep the same position in degrees
+
+static fix_pos rescale(fix_pos value, int old_steps_per_rev) {
+	return (double)value * steps_per_rev / old_steps_per_rev;
+}
+
+static void motion_set_steps_per_rev(int value) {
+	int old_steps_per_rev = steps_per_rev;
+	steps_per_rev = value;
+	if (old_steps_per_rev != 0 && steps_per_rev != 0) {
+		pf = rescale(pf, old_steps_per_rev);
+		vf = rescale(vf, old_steps_per_rev);
+		v0 = rescale(v0, old_steps_per_rev);
+		p0 = rescale(p0, old_steps_per_rev);
+		v_cmd = rescale(v_cmd, old_steps_per_rev);
+		p_cmd = rescale(p_cmd, old_steps_per_rev);
+		segment.a = rescale(segment.a, old_steps_per_rev);
+		segment.v = rescale(segment.v, old_steps_per_rev);
+		segment.v1 = rescale(segment.v1, old_steps_per_rev);
+		segment.p1 = rescale(segment.p1, old_steps_per_rev);
+		segment.p2 = rescale(segment.p2, old_steps_per_rev);
+	}
+	motion_update_limits();
 }
 
-// this accepts commands from command_parser / command_runner.  commands are two letters and a number,
-// so those get decoded into actual function calls here.
+// plan a trapezoidal move from p0 to pf, starting at t0.
+// this assumes that v0 and vf are both zero!
+// an improved version could be made with support for arbitrary initial (and final?!) velocities.
+// this would let us switch from velocity mode to position mode without stopping first.
+
+static void motion_plan_position() {
+
+	fix_pos dp = pf - p0;
+	fix_pos dp_abs = dp > 0 ? dp : -dp;
+	fix_acc a = dp > 0 ? al_fx : -al_fx;
+	uint64_t t01 = fix_time_to_velocity(vl_fx, al_fx);
+	fix_pos p01 = fix_travel(0, a, t01);
+	fix_pos p12 = dp - 2 * p01;
+
+	// special case for if we're doing small movements that will never reach max velocity and have
+	// just accel and decel phases
+	if (2 * (p01 > 0 ? p01 : -p01) > dp_abs) {
+		p01 = dp / 2;
+		p12 = 0;
+		t01 = fix_time_to_distance(dp_abs / 2, al_fx);
+	}
+
+	uint64_t t12 = fix_time_to_travel(p12 > 0 ? p12 : -p12, vl_fx);
+
+	segment.t1 = t01;
+	segment.t2 = segment.t1 + t12;
+	segment.t3 = segment.t2 + t01;
+	segment.a = a;
+	segment.v = dp > 0 ? vl_fx : -vl_fx;
+	segment.v1 = fix_velocity_gain(a, t01);
+	segment.p1 = p0 + p01;
+	segment.p2 = p0 + p01 + p12;
+}
+
+// plan a ramp from v0 to v_tgt, starting at p0 and t0
+
+static void motion_plan_velocity(fix_vel v_tgt) {
+	segment.t1 = fix_time_to_velocity(v_tgt > v0 ? v_tgt - v0 : v0 - v_tgt, al_fx);
+	segment.a = v_tgt > v0 ? al_fx : -al_fx;
+	segment.v = v_tgt;
+	segment.p1 = p0 + fix_travel(v0, segment.a, segment.t1);
+}
+
+// this accepts commands from command_parser / command_runner, through the command table.  commands are
+// two letters and a number, so those get decoded into actual function calls here.
 //
 // supported commands:
 //
@@ -52,50 +154,76 @@ int sign(double value) {
 //   stepper driver's microstepping setting
 //   any mechanical advantage obtained through gearing or belts
 
-void motion_command(motionCommand* command) {
+// Enable / Disable motor
+static void motion_command_enable(int64_t value) {
+	enabled = value != 0;
+}
 
-	// Enable / Disable motor
-	if (command->command[0] == 'e' && command->command[1] == 'n') {
-		enabled = command->value != 0;
-	}
+// Configure Max Velocity (deg/sec)
+static void motion_command_max_velocity(int64_t value) {
+	vl = (double)value / COMMAND_VALUE_SCALE;
+	motion_update_limits();
+}
 
-	// Configure Max Velocity (deg/sec)
-	if (command->command[0] == 'm' && command->command[1] == 'v') {
-		vl = command->value;
-	}
+// Configure Max Acceleration (deg/sec^2)
+static void motion_command_max_acceleration(int64_t value) {
+	al = (double)value / COMMAND_VALUE_SCALE;
+	motion_update_limits();
+}
 
-	// Configure Max Acceleration (deg/sec^2)
-	if (command->command[0] == 'm' && command->command[1] == 'a') {
-		al = command->value;
-	}
+// Configure Steps per Revolution
+static void motion_command_steps_per_rev(int64_t value) {
+	motion_set_steps_per_rev(value / COMMAND_VALUE_SCALE);
+}
 
-	// Configure Steps per Revolution
-	if (command->command[0] == 's' && command->command[1] == 'r') {
-		steps_per_rev = command->value;
+// Position Command (deg)
+static void motion_command_position(int64_t value) {
+	pf = deg_to_fix_pos((double)value / COMMAND_VALUE_SCALE);
+	vf = 0;
+	target_p_mode = true;
+	t0 = t_now;
+	p0 = p_cmd;
+	v0 = v_cmd;
+	// the position planner can only start from rest, so if we're moving, ramp down to a stop first
+	stop_needed = v0 != 0;
+	if (stop_needed) {
+		motion_plan_velocity(0);
 	}
-
-	// Position Command (deg)
-	if (command->command[0] == 't' && command->command[1] == 'p') {
-		pf = command->value;
-		vf = 0;
-		target_p_mode = true;
-		t0 = uptime();
-		p0 = p_cmd;
-		v0 = v_cmd;
-		stop_needed = true;
+	else {
+		motion_plan_position();
 	}
+}
 
-	// Velocity Command (deg/sec)
-	if (command->command[0] == 't' && command->command[1] == 'v') {
-		vf = command->value;
-		pf = 0;
-		target_p_mode = false;
-		t0 = uptime();
-		p0 = p_cmd;
-		v0 = v_cmd;
-		stop_needed = false;
-	}
+// Velocity Command (deg/sec)
+static void motion_command_velocity(int64_t value) {
+	vf = deg_to_fix_vel((double)value / COMMAND_VALUE_SCALE);
+	pf = 0;
+	target_p_mode = false;
+	t0 = t_now;
+	p0 = p_cmd;
+	v0 = v_cmd;
+	stop_needed = false;
+	motion_plan_velocity(vf);
+}
+
+// the ranges keep every value inside what the step domain conversions can represent, at up to
+// 1000000 steps per revolution
+
+static const commandEntry motion_commands[] = {
+	{ "en", COMMAND_VALUE(0), COMMAND_VALUE(1), "", motion_command_enable },
+	{ "mv", COMMAND_VALUE_SCALE / 1000, COMMAND_VALUE(100000), "deg/s", motion_command_max_velocity, true },
+	{ "ma", COMMAND_VALUE_SCALE / 1000, COMMAND_VALUE(1000000), "deg/s^2", motion_command_max_acceleration, true },
+	{ "sr", COMMAND_VALUE(1), COMMAND_VALUE(1000000), "steps/rev", motion_command_steps_per_rev, true },
+	{ "tp", COMMAND_VALUE(-700000), COMMAND_VALUE(700000), "deg", motion_command_position, true },
+	{ "tv", COMMAND_VALUE(-100000), COMMAND_VALUE(100000), "deg/s", motion_command_velocity, true },
+};
+
+// this must be called once before the main loop starts, to set up the step-domain limits
 
+void motion_init() {
+	motion_update_limits();
+	t_now = uptime();
+	command_register(motion_commands, sizeof(motion_commands) / sizeof(motion_commands[0]));
 }
 
 // main motion control command
@@ -103,117 +231,140 @@ void motion_command(motionCommand* command) {
 // its up to the parent code to issue steps to the motor to get it to this position.
 
 int motion_get_position_target_steps() {
+	return motion_get_position_target_steps_at(uptime());
+}
 
-	if (target_p_mode) /* position mode */ {
-		return motion_get_position_target_steps_position_mode();
-	}
-
-	else /* velocity mode */ {
-		return motion_get_position_target_steps_velocity_mode();
-	}
+// same as above, but for any point in time at or after the last one we were asked about.
+// the step engine uses this to plan steps ahead of time.
 
+int motion_get_position_target_steps_at(uint64_t now) {
+	return fix_to_steps(motion_get_position_target_at(now));
 }
 
-// velocity mode
+// evaluates the plan at a point in time, at or after the last one
 
-int motion_get_position_target_steps_velocity_mode() {
+static fix_pos motion_evaluate(uint64_t now) {
 
-	// set our velocity target - either the commanded velocity target if we're in that mode,
-	// or zero if we're in position mode but need to do a stop first
-	float v_tgt;
-	if (stop_needed) {
-		v_tgt = 0;
-		if (v_cmd == 0) {
-			stop_needed = false;
-			t0 = uptime();
-			p0 = p_cmd;
-			v0 = 0;
-		}
+	// never evaluate a move before it started
+	if (now < t0) {
+		now = t0;
 	}
-	else {
-		v_tgt = vf;
-	}
-
-	unsigned long now = uptime();
-	unsigned long tc = fabs((v_tgt - v0) * 1000000) / al;
-	float a = sign(vf - v0) * al;
-	float t = (now - t0) / 1000000.0f;
+	t_now = now;
 
-	if (now > t0 + tc) /* holding at target velocity */ {
-		float tcus = tc / 1000000.0f;
-		float dt = (now - tc - t0) / 1000000.0f;
-		v_cmd = v_tgt;
-		p_cmd = p0 + v0 * tcus + 0.5 * a * tcus * tcus + v_tgt * dt;
+	if (target_p_mode && !stop_needed) /* position mode */ {
+		motion_get_position_target_steps_position_mode();
 	}
 
-	else /* accelerating to target velocity */ {
-		v_cmd = v0 + a * t;
-		p_cmd = p0 + v0 * t + 0.5 * a * t * t;
+	else /* velocity mode */ {
+		motion_get_position_target_steps_velocity_mode();
 	}
 
-	// translation the target position from degrees to steps
-	return p_cmd / 360.0f * steps_per_rev;
+	return p_cmd;
 }
 
-// position mode
+// the exact (fractional) target position at some point in time, with the same rules as above.
+// time-tagged motion commands that come due along the way are run at exactly their time, from wherever
+// the plan has got to by then.  the rest wait for the main loop to reach their time.
 
-int motion_get_position_target_steps_position_mode() {
+fix_pos motion_get_position_target_at(uint64_t now) {
+	motionCommand command;
+	uint64_t time;
+	while (command_schedule_next(now, true, &command, &time)) {
+		if (time > t_now) {
+			motion_evaluate(time);
+		}
+		command_dispatch(&command);
+	}
+	return motion_evaluate(now);
+}
+
+// velocity mode
+// this is also used to bring the motor to a stop before starting a move in position mode
 
-	// this assumes that v0 and vf are both zero!
-	// an improved version could be made with support for arbitrary initial (and final?!) velocities.
-	// this would let us switch from velocity mode to position mode without stopping first.
+int motion_get_position_target_steps_velocity_mode() {
 
-	unsigned long now = uptime();
+	uint64_t t = t_now - t0;
 
-	float t01 = vl / al;
-	int psign = sign(pf - p0);
-	float a = psign * al;
-	float v = psign * vl;
-	float p01 = 0.5f * a * t01 * t01;
-	float p12 = pf - p0 - 2 * p01;
+	if (t > segment.t1) /* holding at target velocity */ {
+		v_cmd = segment.v;
+		p_cmd = segment.p1 + fix_travel(segment.v, 0, t - segment.t1);
+		phase = v_cmd != 0 ? MOTION_PHASE_CRUISE : MOTION_PHASE_REST;
+	}
 
-	// special case for if we're doing small movements that will never reach max velocity and have
-	// just accel and decel phases
-	if (fabs(p01) > 0.5f * fabs(pf - p0)) {
-		p01 = 0.5f * (pf - p0);
-		p12 = 0;
-		t01 = sqrtf(2 * p01 / a);
+	else /* accelerating to target velocity */ {
+		v_cmd = v0 + fix_velocity_gain(segment.a, t);
+		p_cmd = p0 + fix_travel(v0, segment.a, t);
+		phase = stop_needed ? MOTION_PHASE_STOP : MOTION_PHASE_RAMP;
 	}
 
-	float t12 = fabs(p12) / vl;
+	// once we've stopped, start the position move from the exact point where the ramp ended.  rounding
+	// can bring the velocity to zero a little before t1, and then the ramp ends here instead.
+	if (stop_needed && v_cmd == 0) {
+		stop_needed = false;
+		if (t < segment.t1) {
+			t0 = t_now;
+			p0 = p_cmd;
+		}
+		else {
+			t0 += segment.t1;
+			p0 = segment.p1;
+		}
+		v0 = 0;
+		motion_plan_position();
+		return motion_get_position_target_steps_position_mode();
+	}
 
-	unsigned long t1 = t0 + t01 * 1000000;
-	unsigned long t2 = t1 + t12 * 1000000;
-	unsigned long t3 = t2 + t01 * 1000000;
+	return fix_to_steps(p_cmd);
+}
+
+// position mode
 
-	float v1 = a * t01;
+int motion_get_position_target_steps_position_mode() {
 
-	float t = 0;
+	uint64_t now = t_now - t0;
+	uint64_t t = 0;
 
-	if (now > t3) /* done; resting at target position */ {
+	if (now > segment.t3) /* done; resting at target position */ {
 		v_cmd = 0;
 		p_cmd = pf;
+		phase = MOTION_PHASE_REST;
 	}
-	else if (now > t2) /* deceleration phase */ {
-		t = (now - t2) * 0.000001f;
-		v_cmd = v1 - a * t;
-		p_cmd = p0 + p01 + p12 + v1 * t - 0.5 * a * t * t;
+	else if (now > segment.t2) /* deceleration phase */ {
+		t = now - segment.t2;
+		v_cmd = segment.v1 - fix_velocity_gain(segment.a, t);
+		p_cmd = segment.p2 + fix_travel(segment.v1, -segment.a, t);
+		phase = MOTION_PHASE_DECEL;
 	}
-	else if (now > t1) /* constant-velocity phase */ {
-		t = (now - t1) * 0.000001f;
-		v_cmd = v;
-		p_cmd = p0 + p01 + v * t;
+	else if (now > segment.t1) /* constant-velocity phase */ {
+		t = now - segment.t1;
+		v_cmd = segment.v;
+		p_cmd = segment.p1 + fix_travel(segment.v, 0, t);
+		phase = MOTION_PHASE_CRUISE;
 	}
 	else /* acceleration phase */ {
-		t = (now - t0) * 0.000001f;
-		v_cmd = a * t;
-		p_cmd = p0 + 0.5f * a * t * t;
+		t = now;
+		v_cmd = fix_velocity_gain(segment.a, t);
+		p_cmd = p0 + fix_travel(0, segment.a, t);
+		phase = MOTION_PHASE_ACCEL;
 	}
 
-	// translation the target position from degrees to steps
-	return p_cmd / 360.0f * steps_per_rev;
+	return fix_to_steps(p_cmd);
 }
 
 bool motion_get_enabled() {
 	return enabled;
 }
+
+// where the planner last put the motor, and how fast it was going, as of the last time it was asked
+
+fix_pos motion_get_commanded_position() {
+	return p_cmd;
+}
+
+fix_vel motion_get_commanded_velocity() {
+	return v_cmd;
+}
+
+motionPhase motion_get_phase() {
+	return phase;
+}
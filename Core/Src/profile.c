@@ -0,0 +1,68 @@
+#include "profile.h"
+#include "serial.h"
+#include "command_table.h"
+#include <stdio.h>
+
+// cycle counter profiling
+//
+// profile_begin() and profile_end() bracket each section of work.  they're inline and only read the
+// cycle counter and update a few words, so they cost a handful of cycles each.
+//
+// supported commands:
+//
+// pr=0 - reset all statistics
+// pr=1 - send the statistics over the serial port, one line per section:
+//        <section> n=<count> min=<cycles> max=<cycles> mean=<cycles>
+
+profileStats profile_stats[PROFILE_SECTIONS];
+
+static const char* const profile_names[PROFILE_SECTIONS] = {
+	"poll",
+	"plan",
+	"step",
+	"loop",
+	"refill",
+};
+
+void profile_reset() {
+	for (int i = 0; i < PROFILE_SECTIONS; i++) {
+		profile_stats[i].min = UINT32_MAX;
+		profile_stats[i].max = 0;
+		profile_stats[i].count = 0;
+		profile_stats[i].total = 0;
+	}
+}
+
+static void profile_report() {
+	char line[80];
+	for (int i = 0; i < PROFILE_SECTIONS; i++) {
+		profileStats* stats = &profile_stats[i];
+		unsigned long mean = stats->count ? stats->total / stats->count : 0;
+		unsigned long min = stats->count ? stats->min : 0;
+		int len = snprintf(line, sizeof(line), "%s n=%lu min=%lu max=%lu mean=%lu\n",
+				profile_names[i], (unsigned long)stats->count, min, (unsigned long)stats->max, mean);
+		serial_write(line, len);
+	}
+}
+
+static void profile_command(int64_t value) {
+	if (value == 0) {
+		profile_reset();
+	}
+	else {
+		profile_report();
+	}
+}
+
+static const commandEntry profile_commands[] = {
+	{ "pr", COMMAND_VALUE(0), COMMAND_VALUE(1), "", profile_command },
+};
+
+void profile_init() {
+	// the cycle counter is part of the debug unit, which has to be turned on first
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	profile_reset();
+	command_register(profile_commands, sizeof(profile_commands) / sizeof(profile_commands[0]));
+}
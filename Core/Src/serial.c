@@ -0,0 +1,345 @@
+#include "serial.h"
+#include "uptime.h"
+#include "command_table.h"
+#include <stdio.h>
+#include <string.h>
+
+// serial port
+//
+// incoming data is written by DMA into a circular buffer, with no interrupt per byte.  the DMA's half
+// and full transfer interrupts, and the USART's idle line interrupt at the end of each burst, only mark
+// that there's something new; the main loop then reads everything up to where the DMA has got to.
+// those interrupts also count the bytes received, so if the main loop falls so far behind that the DMA
+// laps it, that's noticed: the unread data is thrown away and counted as an overrun, and the command
+// reader is told to start over.
+//
+// outgoing replies are queued in a ring here and sent by DMA, a contiguous run of the ring at a time.
+// when a run finishes, the transmit complete interrupt starts the next one, so nothing ever waits on the
+// serial port and the main loop doesn't touch each byte.
+//
+// the baud rate can be changed at run time, up to 1 Mbaud (USART1 runs off the 16 MHz APB2 clock and
+// oversamples by 16).  the switch is made once the reply to the command has gone out at the old rate.
+// then a command has to arrive at the new rate within SERIAL_CONFIRM_US, or we go back to the old one,
+// so a host that can't keep up doesn't lose the controller.
+//
+// supported commands:
+//
+// br=<baud> - switch to a new baud rate.  the reply is br=<baud> at the old rate, or br=0 if the
+//             rate can't be made accurately enough from our clock.
+
+UART_HandleTypeDef* huart_serial = 0;
+
+uint8_t rx_buffer[SERIAL_RX_LEN];
+unsigned int rx_head = 0;
+unsigned int rx_tail = 0;
+volatile bool rx_event = false;
+volatile bool rx_restarted = false;
+
+// bytes the DMA has written since it was started, as of the last receive event, and where in the buffer
+// that event was.  the DMA can't get more than halfway around without an event, so each one can tell how
+// far it moved since the last.  rx_read counts the bytes taken out, so the difference is what's waiting.
+volatile uint32_t rx_received = 0;
+volatile unsigned int rx_event_pos = 0;
+volatile uint32_t rx_restart_count = 0;
+uint32_t rx_read = 0;
+bool rx_lost = false;
+unsigned long rx_overruns = 0;
+
+unsigned long get_serial_rx_overruns() { return rx_overruns; }
+
+// the main loop writes at tx_head.  tx_sending bytes from tx_tail are being sent by the DMA, and
+// tx_tail only moves when they're done.  data normally wraps at the end of the buffer, but a block
+// reserved with serial_reserve() has to be in one piece, so it may start over at the beginning early,
+// leaving the data to end at tx_wrap.
+uint8_t tx_buffer[SERIAL_TX_LEN];
+volatile unsigned int tx_head = 0;
+volatile unsigned int tx_tail = 0;
+volatile unsigned int tx_sending = 0;
+volatile unsigned int tx_wrap = SERIAL_TX_LEN;
+
+// a baud rate waiting for the transmitter to finish, and the rate to go back to if the new one isn't
+// confirmed by confirm_deadline
+uint32_t pending_baud = 0;
+uint32_t fallback_baud = SERIAL_DEFAULT_BAUD;
+bool confirm_needed = false;
+uint64_t confirm_deadline = 0;
+
+// called by the HAL from the DMA and USART interrupts on half transfer, full transfer, and idle line
+
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef* huart, uint16_t size) {
+	if (huart == huart_serial) {
+		// on a full transfer, size is the whole buffer, and the DMA is back at the start
+		unsigned int pos = size % SERIAL_RX_LEN;
+		rx_received += (pos + SERIAL_RX_LEN - rx_event_pos) % SERIAL_RX_LEN;
+		rx_event_pos = pos;
+		rx_event = true;
+	}
+}
+
+// start sending the next run of the ring, if there is one and the DMA is free.  called from the main
+// loop and from the transmit complete interrupt.
+
+static void serial_tx_start() {
+	unsigned int head = tx_head;
+	unsigned int tail = tx_tail;
+	if (tx_sending != 0 || head == tail) {
+		return;
+	}
+	unsigned int len = head > tail ? head - tail : tx_wrap - tail;
+	tx_sending = len;
+	HAL_UART_Transmit_DMA(huart_serial, &tx_buffer[tail], len);
+}
+
+// start sending from the main loop.  the transmit complete interrupt may be starting a run too, so hold
+// off the serial interrupts (but not the step engine's, which run above them) while we check.
+
+static void serial_tx_kick() {
+	uint32_t basepri = __get_BASEPRI();
+	__set_BASEPRI(SERIAL_IRQ_PRIORITY << (8 - __NVIC_PRIO_BITS));
+	serial_tx_start();
+	__set_BASEPRI(basepri);
+}
+
+// the run being sent is finished with, so move past it and start the next one
+
+static void serial_tx_done() {
+	unsigned int tail = tx_tail + tx_sending;
+	if (tail >= tx_wrap) {
+		tail = 0;
+		tx_wrap = SERIAL_TX_LEN;
+	}
+	tx_tail = tail;
+	tx_sending = 0;
+	serial_tx_start();
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef* huart) {
+	if (huart == huart_serial) {
+		serial_tx_done();
+	}
+}
+
+// a framing, noise, or overrun error stops the receive DMA.  start again from the top of the buffer;
+// whatever line was coming in is lost either way.  a DMA error can stop either direction, and the HAL
+// marks whichever one it stopped as ready again.  a stopped transmit run is dropped, since part of it may
+// have gone out already, and the rest of the ring goes on after it.
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef* huart) {
+	if (huart == huart_serial) {
+		if (huart->RxState == HAL_UART_STATE_READY) {
+			rx_restart_count = rx_received;
+			rx_event_pos = 0;
+			rx_restarted = true;
+			HAL_UARTEx_ReceiveToIdle_DMA(huart_serial, rx_buffer, SERIAL_RX_LEN);
+		}
+		if (tx_sending != 0 && huart->gState == HAL_UART_STATE_READY) {
+			serial_tx_done();
+		}
+	}
+}
+
+// take the next received character, if there is one
+
+bool serial_read_char(char* c) {
+	if (rx_restarted) {
+		rx_restarted = false;
+		rx_head = 0;
+		rx_tail = 0;
+		rx_read = rx_restart_count;
+		rx_lost = true;
+		return false;
+	}
+
+	if (rx_tail == rx_head) {
+		if (!rx_event) {
+			return false;
+		}
+		// clear the flag before looking, so an event that lands while we look isn't lost.  where the DMA
+		// is and the count from the last event have to go together, so hold off the serial interrupts.
+		rx_event = false;
+		uint32_t basepri = __get_BASEPRI();
+		__set_BASEPRI(SERIAL_IRQ_PRIORITY << (8 - __NVIC_PRIO_BITS));
+		unsigned int pos = (SERIAL_RX_LEN - __HAL_DMA_GET_COUNTER(huart_serial->hdmarx)) % SERIAL_RX_LEN;
+		uint32_t received = rx_received + (pos + SERIAL_RX_LEN - rx_event_pos) % SERIAL_RX_LEN;
+		__set_BASEPRI(basepri);
+
+		// a whole buffer or more came in since we last caught up, so the DMA has written over data we
+		// hadn't read yet (a full buffer can't be told apart from an empty one either).  what's left is a
+		// mix of old and new, so skip to where the DMA is now.
+		if (received - rx_read >= SERIAL_RX_LEN) {
+			rx_overruns++;
+			rx_head = pos;
+			rx_tail = pos;
+			rx_read = received;
+			rx_lost = true;
+			return false;
+		}
+
+		rx_head = pos;
+		if (rx_tail == rx_head) {
+			return false;
+		}
+	}
+
+	*c = rx_buffer[rx_tail];
+	rx_tail = (rx_tail + 1) % SERIAL_RX_LEN;
+	rx_read++;
+	return true;
+}
+
+// whether received data has been lost since the last call, to an overrun or a receive error
+
+bool serial_rx_lost() {
+	bool lost = rx_lost;
+	rx_lost = false;
+	return lost;
+}
+
+bool serial_write(const char* data, unsigned int len) {
+	unsigned int free = (tx_tail + SERIAL_TX_LEN - tx_head - 1) % SERIAL_TX_LEN;
+	if (len > free) {
+		return false;
+	}
+	unsigned int head = tx_head;
+	for (unsigned int i = 0; i < len; i++) {
+		tx_buffer[head] = data[i];
+		head = (head + 1) % SERIAL_TX_LEN;
+	}
+	// the data has to be in place before the interrupt can see the new head
+	__DMB();
+	tx_head = head;
+	serial_tx_kick();
+	return true;
+}
+
+// room for len bytes in one piece, straight in the transmit ring, so a message can be built where it
+// will be sent from instead of being copied in.  returns 0 if there isn't room.  nothing is sent until
+// serial_commit(), and nothing else may be written in between.
+
+uint8_t* serial_reserve(unsigned int len) {
+	unsigned int head = tx_head;
+	unsigned int tail = tx_tail;
+	if (head >= tail) {
+		// one byte always stays free, so a full ring doesn't look empty
+		unsigned int end_room = SERIAL_TX_LEN - head - (tail == 0 ? 1 : 0);
+		if (len <= end_room) {
+			return &tx_buffer[head];
+		}
+		if (len < tail) {
+			return &tx_buffer[0];
+		}
+		return 0;
+	}
+	return len < tail - head ? &tx_buffer[head] : 0;
+}
+
+void serial_commit(uint8_t* data, unsigned int len) {
+	unsigned int start = data - tx_buffer;
+	__DMB();
+	uint32_t basepri = __get_BASEPRI();
+	__set_BASEPRI(SERIAL_IRQ_PRIORITY << (8 - __NVIC_PRIO_BITS));
+	if (start != tx_head) {
+		// the block started over at the beginning of the buffer.  if the ring is empty, nothing is being
+		// sent, so just start over there too.
+		if (tx_tail == tx_head) {
+			tx_tail = 0;
+		}
+		else {
+			tx_wrap = tx_head;
+		}
+	}
+	tx_head = (start + len) % SERIAL_TX_LEN;
+	serial_tx_start();
+	__set_BASEPRI(basepri);
+}
+
+bool serial_print(const char* text) {
+	return serial_write(text, strlen(text));
+}
+
+// the BRR value for a baud rate, or 0 if it can't be made to within SERIAL_MAX_BAUD_ERROR
+
+static uint32_t serial_brr(uint32_t baud) {
+	uint32_t pclk = HAL_RCC_GetPCLK2Freq();
+	if (baud == 0 || baud > pclk / 16) {
+		return 0;
+	}
+	uint32_t brr = UART_BRR_SAMPLING16(pclk, baud);
+	uint32_t actual = pclk / brr;
+	uint32_t error = actual > baud ? actual - baud : baud - actual;
+	if ((uint64_t)error * 1000 > (uint64_t)baud * SERIAL_MAX_BAUD_ERROR) {
+		return 0;
+	}
+	return brr;
+}
+
+// reprogram the baud rate.  the receive DMA keeps running through this.
+
+static void serial_apply_baud(uint32_t baud) {
+	USART_TypeDef* usart = huart_serial->Instance;
+	usart->CR1 &= ~USART_CR1_UE;
+	usart->BRR = serial_brr(baud);
+	usart->CR1 |= USART_CR1_UE;
+	huart_serial->Init.BaudRate = baud;
+}
+
+// ask for a new baud rate.  returns false if it can't be made accurately enough.
+
+bool serial_set_baud(uint32_t baud) {
+	if (serial_brr(baud) == 0) {
+		return false;
+	}
+	pending_baud = baud;
+	return true;
+}
+
+// a command came in, so whatever rate we're at works
+
+void serial_confirm_baud() {
+	if (confirm_needed) {
+		confirm_needed = false;
+		fallback_baud = huart_serial->Init.BaudRate;
+	}
+}
+
+// br=X - switch to X baud.  the reply goes out at the old rate, and is br=0 if X can't be made
+
+static void serial_command(int64_t value) {
+	char reply[20];
+	uint32_t baud = value / COMMAND_VALUE_SCALE;
+	if (!serial_set_baud(baud)) {
+		baud = 0;
+	}
+	snprintf(reply, sizeof(reply), "br=%lu\n", (unsigned long)baud);
+	serial_print(reply);
+}
+
+static const commandEntry serial_commands[] = {
+	{ "br", COMMAND_VALUE(0), COMMAND_VALUE(10000000), "baud", serial_command },
+};
+
+void serial_init(UART_HandleTypeDef* _huart) {
+	huart_serial = _huart;
+	HAL_UARTEx_ReceiveToIdle_DMA(huart_serial, rx_buffer, SERIAL_RX_LEN);
+	command_register(serial_commands, sizeof(serial_commands) / sizeof(serial_commands[0]));
+}
+
+// this should be called frequently by the main loop
+
+void serial_poll() {
+	USART_TypeDef* usart = huart_serial->Instance;
+
+	// change baud rates once the last byte at the old rate is completely out
+	if (pending_baud && tx_tail == tx_head && tx_sending == 0 && (usart->SR & USART_SR_TC)) {
+		fallback_baud = huart_serial->Init.BaudRate;
+		serial_apply_baud(pending_baud);
+		pending_baud = 0;
+		confirm_needed = true;
+		confirm_deadline = uptime() + SERIAL_CONFIRM_US;
+	}
+
+	if (confirm_needed && uptime() >= confirm_deadline) {
+		confirm_needed = false;
+		serial_apply_baud(fallback_baud);
+	}
+}
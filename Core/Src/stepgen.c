@@ -0,0 +1,358 @@
+#include "stepgen.h"
+#include "motion.h"
+#include "stepper.h"
+#include "profile.h"
+#include "uptime.h"
+#include <stdbool.h>
+
+// DMA-fed step engine
+//
+// TIM1 runs in PWM mode 2 on channel 1 (PA8), so each timer period ends with one step pulse.  on every
+// update event, two DMA channels fire (TIM1_CR2.CCDS moves the CC1/CC2 DMA requests to the update event):
+//
+// - the CC2 request bursts the next {ARR, RCR, CCR1} from the ring into the timer's preload registers,
+//   which take effect at the following update.  a CCR1 past ARR means "no pulse in this period".
+// - the CC1 request writes the next word of the direction ring into GPIOB->BSRR, which changes the
+//   direction pin (PB3) right away, at the start of the period whose pulse it belongs to.
+//
+// because the period loaded at update N runs from update N+1, the direction for the period in
+// ring[i] lives in ring_dir[i + 1].  a zero direction word leaves the pin alone.
+//
+// the work is split in two:
+//
+// - background: stepgen_fill() is called from the main loop.  it works out the exact time of every step
+//   from the motion plan and writes them into a block as segments, each a run of equal step periods.
+//   nothing is ever quantized to the main loop's period; the timer's compare fires at the computed instant.
+// - foreground: the CC2 DMA channel's half and full transfer interrupts turn segments from the block
+//   being played into ring slots, half a ring at a time.  this is short, bounded work at the highest
+//   interrupt priority, so the main loop and the serial port can take as long as they like as long as
+//   a block is ready when the interrupt needs one.
+//
+// the two blocks are handed back and forth with their ready flags.  the main loop only writes a block
+// that isn't ready and the interrupt only reads one that is, so neither needs to lock anything.
+
+#define STEPGEN_NO_PULSE 0xFFFF
+
+typedef struct stepgenSlot {
+	uint16_t arr;
+	uint16_t rcr;
+	uint16_t ccr1;
+} stepgenSlot;
+
+typedef struct stepgenSegment {
+	uint32_t period;
+	uint16_t count;
+	uint8_t step;
+	uint8_t forward;
+} stepgenSegment;
+
+typedef struct stepgenBlock {
+	stepgenSegment segments[STEPGEN_BLOCK_LEN];
+	unsigned int len;
+	unsigned long ticks;
+	volatile bool ready;
+} stepgenBlock;
+
+stepgenSlot ring[STEPGEN_RING_LEN];
+uint32_t ring_dir[STEPGEN_RING_LEN];
+
+stepgenBlock blocks[2];
+
+TIM_HandleTypeDef* htim_stepgen = 0;
+
+// foreground state: where we are in the block being played, and what's left of the period that was
+// split across ring slots
+unsigned int play_block = 0;
+unsigned int play_segment = 0;
+unsigned int play_count = 0;
+unsigned long play_remaining = 0;
+bool play_step = false;
+bool play_forward = false;
+
+// time the foreground filled with blank slots because no block was ready
+volatile unsigned long underrun_ticks = 0;
+
+// background state.  all times are in timer ticks, and tick 0 is at uptime() == start_us.
+unsigned int fill_block = 0;
+unsigned long underrun_seen = 0;
+uint64_t start_us = 0;
+
+// end of the last planned period
+uint64_t cursor_ticks = 0;
+
+// the last planner sample, which every step up to stepgen_position has been planned for, and the one
+// being worked towards
+uint64_t sample_ticks = 0;
+fix_pos sample_position = 0;
+uint64_t next_ticks = 0;
+fix_pos next_position = 0;
+int next_target = 0;
+
+// position after the last planned step
+int stepgen_position = 0;
+
+// no steps before this, while the driver settles after being enabled.  this only holds back steps
+// planned after the enable.  the two blocks already handed to the foreground, up to 2 * STEPGEN_BLOCK_TICKS
+// of steps planned while the motor was off, play out as planned and can land in the settling time, where
+// the driver may miss them.  those blocks belong to the interrupt once they're ready, so they can't be
+// re-timed from here.  so en=1 during a move can lose the steps in its first STEPPER_ENABLE_SETTLE_US.
+int64_t ready_ticks = 0;
+
+// steps that went out later than the plan wanted, because they came too soon after the one before
+unsigned long rate_limited_steps = 0;
+
+// foreground
+
+// take the next period from the block being played.  returns false if the main loop hasn't handed one over.
+
+static bool stepgen_next_period() {
+	stepgenBlock* block = &blocks[play_block];
+	if (!block->ready) {
+		return false;
+	}
+
+	stepgenSegment* segment = &block->segments[play_segment];
+	play_remaining = segment->period;
+	play_step = segment->step;
+	play_forward = segment->forward;
+
+	if (++play_count == segment->count) {
+		play_count = 0;
+		if (++play_segment == block->len) {
+			// that was the last one: give the block back and go on to the other
+			play_segment = 0;
+			play_block ^= 1;
+			block->len = 0;
+			block->ticks = 0;
+			block->ready = false;
+		}
+	}
+	return true;
+}
+
+// write count ring slots, starting at index
+
+static void stepgen_refill(unsigned int index, unsigned int count) {
+	profile_begin(PROFILE_REFILL);
+	while (count--) {
+		unsigned long ticks = STEPGEN_SLOT_TICKS;
+		bool pulse = false;
+
+		if (play_remaining == 0 && !stepgen_next_period()) {
+			// nothing to play.  the main loop finds out about the time that went by without it.
+			underrun_ticks += ticks;
+		}
+		else {
+			// long periods are split so the last piece is never too short for the DMA to keep up with
+			ticks = play_remaining;
+			if (ticks > 2 * STEPGEN_SLOT_TICKS) {
+				ticks = STEPGEN_SLOT_TICKS;
+			}
+			else if (ticks > STEPGEN_SLOT_TICKS) {
+				ticks /= 2;
+			}
+			play_remaining -= ticks;
+			pulse = play_step && play_remaining == 0;
+		}
+
+		stepgenSlot* slot = &ring[index];
+		slot->arr = ticks - 1;
+		slot->rcr = 0;
+		slot->ccr1 = pulse ? ticks - STEPGEN_PULSE_TICKS : STEPGEN_NO_PULSE;
+
+		index = (index + 1) % STEPGEN_RING_LEN;
+		ring_dir[index] = pulse ? (play_forward ? GPIO_PIN_3 : (uint32_t)GPIO_PIN_3 << 16) : 0;
+	}
+	profile_end(PROFILE_REFILL);
+}
+
+// the slots written by each interrupt are shifted back by one from the half the DMA just finished,
+// since the direction word for the last slot of a half lives in the first word of the other half,
+// which the DMA hasn't read yet.
+
+static void stepgen_half_transfer(DMA_HandleTypeDef* hdma) {
+	stepgen_refill(STEPGEN_RING_LEN - 1, STEPGEN_RING_LEN / 2);
+}
+
+static void stepgen_transfer_complete(DMA_HandleTypeDef* hdma) {
+	stepgen_refill(STEPGEN_RING_LEN / 2 - 1, STEPGEN_RING_LEN / 2);
+}
+
+// background
+
+// hand the block being filled over to the foreground, and move on to the other one
+
+static void stepgen_publish() {
+	stepgenBlock* block = &blocks[fill_block];
+	if (block->len == 0) {
+		return;
+	}
+	// the segments have to be in memory before the interrupt can see the flag
+	__DMB();
+	block->ready = true;
+	fill_block ^= 1;
+}
+
+// plan a period.  runs of equal periods are stored as one segment.
+
+static void stepgen_push(unsigned long ticks, bool step, bool forward) {
+	stepgenBlock* block = &blocks[fill_block];
+	stepgenSegment* segment = block->len > 0 ? &block->segments[block->len - 1] : 0;
+	if (segment && segment->period == ticks && segment->step == step && segment->forward == forward && segment->count < 0xFFFF) {
+		segment->count++;
+	}
+	else {
+		segment = &block->segments[block->len++];
+		segment->period = ticks;
+		segment->count = 1;
+		segment->step = step;
+		segment->forward = forward;
+	}
+
+	block->ticks += ticks;
+	cursor_ticks += ticks;
+
+	if (block->len == STEPGEN_BLOCK_LEN || block->ticks >= STEPGEN_BLOCK_TICKS) {
+		stepgen_publish();
+	}
+}
+
+// plan a step that should happen at the given time.  if that's sooner than the driver can take after
+// the last one, it goes out as soon as it can instead.  the pulse rises STEPGEN_PULSE_TICKS before the
+// end of its period, so the period ends that much after the step's time.
+
+static void stepgen_step_at(uint64_t ticks, bool forward) {
+	if ((int64_t)ticks < ready_ticks) {
+		ticks = ready_ticks;
+	}
+	ticks += STEPGEN_PULSE_TICKS;
+	int64_t period = ticks - cursor_ticks;
+	if (period < STEPGEN_MIN_PERIOD_TICKS) {
+		period = STEPGEN_MIN_PERIOD_TICKS;
+		rate_limited_steps++;
+	}
+	stepgen_push(period, true, forward);
+}
+
+// the position at which the planner's target (truncated toward zero, see fix_to_steps) moves on from
+// position to the next step in the given direction
+
+static fix_pos stepgen_boundary(int position, bool forward) {
+	if (forward) {
+		return (fix_pos)(position >= 0 ? position + 1 : position) * FIX_POS_ONE_STEP;
+	}
+	else {
+		return (fix_pos)(position > 0 ? position : position - 1) * FIX_POS_ONE_STEP;
+	}
+}
+
+// how far into a sample that moves dp, we've moved dist (0 < dist <= dp).
+// this is the hot path at high step rates, so use a 32-bit divide when the numbers allow.
+
+static unsigned int stepgen_crossing(fix_pos dist, fix_pos dp) {
+	if (dp >= FIX_POS_ONE_STEP && dp < (FIX_POS_ONE_STEP << 7)) {
+		return (uint32_t)(dist >> 16) * STEPGEN_SAMPLE_TICKS / (uint32_t)(dp >> 16);
+	}
+	return (uint64_t)dist * STEPGEN_SAMPLE_TICKS / (uint64_t)dp;
+}
+
+void stepgen_init(TIM_HandleTypeDef* _htim) {
+	htim_stepgen = _htim;
+	TIM_TypeDef* tim = htim_stepgen->Instance;
+
+	for (int i = 0; i < STEPGEN_RING_LEN; i++) {
+		ring[i].arr = STEPGEN_SLOT_TICKS - 1;
+		ring[i].rcr = 0;
+		ring[i].ccr1 = STEPGEN_NO_PULSE;
+		ring_dir[i] = 0;
+	}
+
+	// 32 MHz / 4 = 8 MHz.  start with an idle period, and load it with an update before anything else
+	// is turned on so the DMA doesn't fire early.
+	tim->PSC = 32 / STEPGEN_TICKS_PER_US - 1;
+	tim->ARR = STEPGEN_SLOT_TICKS - 1;
+	tim->RCR = 0;
+	tim->CCR1 = STEPGEN_NO_PULSE;
+	MODIFY_REG(tim->CCMR1, TIM_CCMR1_OC1M, TIM_OCMODE_PWM2 | TIM_CCMR1_OC1PE);
+	tim->CR1 |= TIM_CR1_ARPE;
+	tim->CR2 |= TIM_CR2_CCDS;
+	tim->DCR = TIM_DMABASE_ARR | TIM_DMABURSTLENGTH_3TRANSFERS;
+	tim->EGR = TIM_EGR_UG;
+
+	DMA_HandleTypeDef* hdma_ring = htim_stepgen->hdma[TIM_DMA_ID_CC2];
+	hdma_ring->XferHalfCpltCallback = stepgen_half_transfer;
+	hdma_ring->XferCpltCallback = stepgen_transfer_complete;
+	HAL_DMA_Start_IT(hdma_ring, (uint32_t)ring, (uint32_t)&tim->DMAR, STEPGEN_RING_LEN * 3);
+	HAL_DMA_Start(htim_stepgen->hdma[TIM_DMA_ID_CC1], (uint32_t)ring_dir, (uint32_t)&GPIOB->BSRR, STEPGEN_RING_LEN);
+	__HAL_TIM_ENABLE_DMA(htim_stepgen, TIM_DMA_CC1 | TIM_DMA_CC2);
+
+	// the first slot the interrupt writes is the last one in the ring, which plays after the two idle
+	// periods loaded into the timer here and the rest of the blank ring
+	start_us = uptime() + (STEPGEN_RING_LEN + 1) * STEPGEN_SLOT_TICKS / STEPGEN_TICKS_PER_US;
+
+	tim->CCER |= TIM_CCER_CC1E;
+	__HAL_TIM_MOE_ENABLE(htim_stepgen);
+	__HAL_TIM_ENABLE(htim_stepgen);
+}
+
+void stepgen_fill() {
+
+	// if the foreground ran dry, that time has passed without us.  this also happens at startup, before
+	// the first block is ready.
+	unsigned long underrun = underrun_ticks;
+	cursor_ticks += underrun - underrun_seen;
+	underrun_seen = underrun;
+
+	// direction setup is built into every period, but the enable pin's settling time has to be waited out
+	ready_ticks = (int64_t)(stepper_get_ready_time() - start_us) * STEPGEN_TICKS_PER_US;
+
+	// plan ahead while there's a block to plan into.  each sample asks the planner where we should be
+	// STEPGEN_SAMPLE_TICKS later, and the steps needed to get there are timed by where the path between
+	// the two samples crosses each step boundary.
+	while (!blocks[fill_block].ready) {
+
+		if (stepgen_position != next_target) {
+			bool forward = next_target > stepgen_position;
+			fix_pos dist = stepgen_boundary(stepgen_position, forward) - sample_position;
+			fix_pos dp = next_position - sample_position;
+			if (!forward) {
+				dist = -dist;
+				dp = -dp;
+			}
+			unsigned int offset = 0;
+			if (dist >= dp) {
+				offset = STEPGEN_SAMPLE_TICKS;
+			}
+			else if (dist > 0) {
+				offset = stepgen_crossing(dist, dp);
+			}
+			stepgen_step_at(sample_ticks + offset, forward);
+			stepgen_position += forward ? 1 : -1;
+			continue;
+		}
+
+		// all steps up to the next sample are planned
+		sample_ticks = next_ticks;
+		sample_position = next_position;
+
+		// between widely spaced steps, plan the idle time as it goes by so the foreground always has
+		// something to play.  leave enough of it that the next step's period can't come up short.
+		if ((int64_t)(sample_ticks - cursor_ticks) >= STEPGEN_BLOCK_TICKS / 2) {
+			stepgen_push(sample_ticks - cursor_ticks - STEPGEN_MIN_PERIOD_TICKS, false, false);
+			continue;
+		}
+
+		next_ticks = sample_ticks + STEPGEN_SAMPLE_TICKS;
+		next_position = motion_get_position_target_at(start_us + next_ticks / STEPGEN_TICKS_PER_US);
+		next_target = fix_to_steps(next_position);
+	}
+
+}
+
+int stepgen_get_position() {
+	return stepgen_position;
+}
+
+unsigned long stepgen_get_rate_limited_steps() {
+	return rate_limited_steps;
+}
@@ -5,33 +5,144 @@
 //
 // we expect the stepper driver to be wired up as follows:
 // ENABLE - PB4
-// DIRECTION - PB4
-// PULSE - PA15
+// DIRECTION - PB3
+// PULSE - PA8 (TIM1_CH1), or PA15 if STEPPER_PULSE_TIMER is turned off
+//
+// with STEPPER_PULSE_TIMER, pulses are made by the timer in one-pulse mode with the repetition counter
+// set: it plays a burst of evenly spaced periods in PWM mode 2, each ending in one pulse, and stops by
+// itself after the last one.  stepper_step() and stepper_step_burst() never wait, and neither the pulse
+// width nor the spacing depends on what the main loop is doing.
+
+TIM_HandleTypeDef* htim_step = 0;
+
+void stepper_init(TIM_HandleTypeDef* _htim) {
+	htim_step = _htim;
+#ifdef STEPPER_PULSE_TIMER
+	TIM_TypeDef* tim = htim_step->Instance;
+	// the counter only runs during a burst.  between bursts it sits at 0, below CCR1, so the output is low.
+	__HAL_TIM_DISABLE(htim_step);
+	tim->CNT = 0;
+	tim->CR1 |= TIM_CR1_OPM;
+	MODIFY_REG(tim->CCMR1, TIM_CCMR1_OC1M, TIM_OCMODE_PWM2 | TIM_CCMR1_OC1PE);
+	tim->CCR1 = 0xFFFF;
+	HAL_TIM_PWM_Start(htim_step, TIM_CHANNEL_1);
+	__HAL_TIM_DISABLE(htim_step);
+#endif
+}
+
+// the driver needs time to settle after being enabled or disabled, and the direction signal has to lead
+// each pulse.  nothing here waits for those: each change just records when it's over, and steps aren't
+// sent before then.
+uint64_t enable_ready_time = 0;
+uint64_t direction_ready_time = 0;
+
+static bool stepper_time_reached(uint64_t time) {
+	return uptime() >= time;
+}
 
 void stepper_enable() {
 	HAL_GPIO_WritePin(GPIOB, GPIO_PIN_4, GPIO_PIN_RESET);
-	sleep(100);
+	enable_ready_time = uptime() + STEPPER_ENABLE_SETTLE_US;
 }
 
 void stepper_disable() {
 	HAL_GPIO_WritePin(GPIOB, GPIO_PIN_4, GPIO_PIN_SET);
-	sleep(100);
+	enable_ready_time = uptime() + STEPPER_ENABLE_SETTLE_US;
 }
 
 void stepper_direction(bool forward) {
 	HAL_GPIO_WritePin(GPIOB, GPIO_PIN_3, forward ? GPIO_PIN_SET : GPIO_PIN_RESET);
-	// direction signal must lead pulse by at least 5 us
-	sleep(5);
+	direction_ready_time = uptime() + STEPPER_DIRECTION_SETUP_US;
+}
+
+uint64_t stepper_get_ready_time() {
+	return direction_ready_time > enable_ready_time ? direction_ready_time : enable_ready_time;
+}
+
+bool stepper_ready() {
+	return stepper_time_reached(stepper_get_ready_time());
 }
 
 bool last_step_forward = false;
 
-void stepper_step_direction(bool forward) {
+bool stepper_step_direction(bool forward) {
 	if (forward != last_step_forward) {
 		stepper_direction(forward);
 		last_step_forward = forward;
 	}
+	if (!stepper_ready()) {
+		return false;
+	}
 	stepper_step();
+	return true;
+}
+
+#ifdef STEPPER_PULSE_TIMER
+
+int stepper_step_burst(bool forward, int count, unsigned int window_ticks) {
+	TIM_TypeDef* tim = htim_step->Instance;
+
+	// the last burst hasn't finished yet
+	if (tim->CR1 & TIM_CR1_CEN) {
+		return 0;
+	}
+
+	// as many steps as fit in the window, up to what the repetition counter can count
+	int max_count = window_ticks / STEPPER_MIN_PERIOD_TICKS;
+	if (max_count > 256) {
+		max_count = 256;
+	}
+	if (count > max_count) {
+		count = max_count;
+	}
+	if (count <= 0) {
+		return 0;
+	}
+
+	if (forward != last_step_forward) {
+		stepper_direction(forward);
+		last_step_forward = forward;
+	}
+
+	// the first pulse rises CCR1 ticks after the burst starts.  periods are at least
+	// STEPPER_MIN_PERIOD_TICKS, so a reversal just above is always set up by then, but an earlier
+	// direction change or the driver settling after an enable can still hold the burst back.
+	unsigned int period = window_ticks / count;
+	if (uptime() + period - STEPPER_PULSE_TICKS < stepper_get_ready_time()) {
+		return 0;
+	}
+
+	// load the burst with an update event while the counter is stopped, then let it run
+	tim->ARR = period - 1;
+	tim->CCR1 = period - STEPPER_PULSE_TICKS;
+	tim->RCR = count - 1;
+	tim->EGR = TIM_EGR_UG;
+	__HAL_TIM_ENABLE(htim_step);
+	return count;
+}
+
+void stepper_step() {
+	TIM_TypeDef* tim = htim_step->Instance;
+	if (tim->CR1 & TIM_CR1_CEN) {
+		return;
+	}
+	// the pulse rises STEPPER_DIRECTION_SETUP_US after this, so a direction written just before is set up
+	tim->ARR = STEPPER_MIN_PERIOD_TICKS - 1;
+	tim->CCR1 = STEPPER_MIN_PERIOD_TICKS - STEPPER_PULSE_TICKS;
+	tim->RCR = 0;
+	tim->EGR = TIM_EGR_UG;
+	__HAL_TIM_ENABLE(htim_step);
+}
+
+#else
+
+int stepper_step_burst(bool forward, int count, unsigned int window_ticks) {
+	// without the timer, each step holds up the loop, so only one goes out per call.  after a reversal
+	// it waits for the next call, once the direction has had time to set up.
+	if (count <= 0) {
+		return 0;
+	}
+	return stepper_step_direction(forward) ? 1 : 0;
 }
 
 void stepper_step() {
@@ -40,3 +151,5 @@ void stepper_step() {
 	sleep(3);
 	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_15, GPIO_PIN_RESET);
 }
+
+#endif
@@ -0,0 +1,127 @@
+#include "telemetry.h"
+#include "main_real.h"
+#include "motion.h"
+#include "serial.h"
+#include "uptime.h"
+#include "command_table.h"
+#include "command_frame.h"
+#include "command_parser.h"
+#include "command_schedule.h"
+#include <stdio.h>
+
+// telemetry read back over the serial port
+//
+// each query is answered with one line, timestamped with the uptime in seconds when it was answered,
+// so the host can take out the time the reply spent on the wire.  the value after the = is ignored.
+//
+// supported commands:
+//
+// qp=0 - commanded position:  qp=<steps> t=<seconds>
+// qv=0 - commanded velocity:  qv=<steps per second> t=<seconds>
+// qa=0 - actual position:     qa=<steps> t=<seconds>
+// qi=0 - loop idle time:      qi=<microseconds> t=<seconds>
+// qe=0 - motor enabled:       qe=<0 or 1> t=<seconds>
+// qc=0 - command counters:    qc=<deepest command queue> o=<commands dropped, queue full>
+//                             x=<serial receive overruns> r=<loops rate limited>
+//                             n=<commands rejected, unknown or out of range>
+//                             d=<telemetry records dropped>
+//                             s=<time-tagged commands dropped, schedule full> t=<seconds>
+// ts=X - stream a binary telemetryRecord (see telemetry.h) X times per second.  ts=0 stops.
+//
+// positions and velocities are in steps rather than degrees, so they're exact and need no floating point.
+//
+// streamed records are built straight in the serial transmit ring and sent from there by DMA.  if the
+// ring is too full, because the baud rate is too low for the rate, the record is dropped and counted
+// (d= in the qc= reply).
+
+uint64_t stream_period = 0;
+uint64_t next_stream_time = 0;
+uint8_t stream_sequence = 0;
+unsigned long telemetry_dropped = 0;
+
+static void telemetry_reply(const char* name, long value) {
+	uint64_t now = uptime();
+	char reply[40];
+	int len = snprintf(reply, sizeof(reply), "%s=%ld t=%lu.%06lu\n", name, value,
+			(unsigned long)(now / 1000000), (unsigned long)(now % 1000000));
+	serial_write(reply, len);
+}
+
+static void telemetry_position(int64_t value) {
+	telemetry_reply("qp", fix_to_steps(motion_get_commanded_position()));
+}
+
+static void telemetry_velocity(int64_t value) {
+	telemetry_reply("qv", (motion_get_commanded_velocity() * 1000000) >> 32);
+}
+
+static void telemetry_actual_position(int64_t value) {
+	telemetry_reply("qa", get_actual_position_steps());
+}
+
+static void telemetry_idle_time(int64_t value) {
+	telemetry_reply("qi", get_last_idle_time());
+}
+
+static void telemetry_enabled(int64_t value) {
+	telemetry_reply("qe", motion_get_enabled());
+}
+
+static void telemetry_counters(int64_t value) {
+	uint64_t now = uptime();
+	char reply[128];
+	int len = snprintf(reply, sizeof(reply), "qc=%u o=%lu x=%lu r=%lu n=%lu d=%lu s=%lu t=%lu.%06lu\n",
+			get_command_queue_max_depth(), get_command_overflows(), get_serial_rx_overruns(),
+			get_rate_limited_ticks(), get_command_rejected(), telemetry_dropped,
+			get_command_schedule_overflows(),
+			(unsigned long)(now / 1000000), (unsigned long)(now % 1000000));
+	serial_write(reply, len);
+}
+
+static void telemetry_stream(int64_t value) {
+	stream_period = value > 0 ? (uint64_t)1000000 * COMMAND_VALUE_SCALE / value : 0;
+	next_stream_time = uptime();
+}
+
+// this should be called every main loop iteration, after the motor has been moved
+
+void telemetry_poll(uint64_t now) {
+	if (stream_period == 0 || now < next_stream_time) {
+		return;
+	}
+	next_stream_time += stream_period;
+	// don't try to catch up after falling behind
+	if (next_stream_time < now) {
+		next_stream_time = now;
+	}
+
+	telemetryRecord* record = (telemetryRecord*)serial_reserve(sizeof(telemetryRecord));
+	if (record == 0) {
+		telemetry_dropped++;
+		return;
+	}
+	record->sync = TELEMETRY_SYNC;
+	record->sequence = stream_sequence++;
+	record->time = now;
+	record->target = fix_to_steps(motion_get_commanded_position());
+	record->actual = get_actual_position_steps();
+	record->velocity = (motion_get_commanded_velocity() * 1000000) >> 32;
+	record->phase = motion_get_phase();
+	record->idle = get_last_idle_time();
+	record->crc = command_frame_crc((uint8_t*)record + 1, sizeof(telemetryRecord) - 3);
+	serial_commit((uint8_t*)record, sizeof(telemetryRecord));
+}
+
+static const commandEntry telemetry_commands[] = {
+	{ "qp", COMMAND_VALUE(0), COMMAND_VALUE(0), "steps", telemetry_position },
+	{ "qv", COMMAND_VALUE(0), COMMAND_VALUE(0), "steps/s", telemetry_velocity },
+	{ "qa", COMMAND_VALUE(0), COMMAND_VALUE(0), "steps", telemetry_actual_position },
+	{ "qi", COMMAND_VALUE(0), COMMAND_VALUE(0), "us", telemetry_idle_time },
+	{ "qe", COMMAND_VALUE(0), COMMAND_VALUE(0), "", telemetry_enabled },
+	{ "qc", COMMAND_VALUE(0), COMMAND_VALUE(0), "", telemetry_counters },
+	{ "ts", COMMAND_VALUE(0), COMMAND_VALUE(TELEMETRY_MAX_RATE), "1/s", telemetry_stream },
+};
+
+void telemetry_init() {
+	command_register(telemetry_commands, sizeof(telemetry_commands) / sizeof(telemetry_commands[0]));
+}
@@ -1,36 +1,54 @@
 #include "uptime.h"
 
 // timebase section
-// there's a timer that ticks at 1 khz and calls stepper_int()
-// that timer also has a counter that counts up microseconds since the last tick
-// by counting ticks and adding microseconds, we can get exact microseconds since beginning at any point
-
-volatile unsigned long uptime_us = 0;
-
-TIM_HandleTypeDef* htim = 0;
-
-void uptime_init(TIM_HandleTypeDef* _htim) {
-	htim = _htim;
+// one timer counts microseconds, and every time it rolls over, its update event clocks a second timer
+// (TIM2 is TIM3's master, on internal trigger ITR1).  between them they make a 32-bit microsecond counter
+// that needs no interrupt.  uptime() reads both halves and extends that to 64 bits, which never rolls over.
+
+TIM_HandleTypeDef* htim_low = 0;
+TIM_HandleTypeDef* htim_high = 0;
+
+// the last 32-bit count we read, and how many times the count has rolled over.  a rollover is only
+// caught if uptime() is called at least once every 71 minutes (2^32 microseconds); any longer and one is
+// missed, and the time jumps back by that much.  the main loop calls it every iteration.
+//
+// only the main loop calls uptime(), so these are never updated from two places at once and need no
+// lock.  an interrupt that wants the time would have to read the timers itself, or this would need
+// interrupts held off around the update.
+uint32_t last_count = 0;
+uint32_t rollovers = 0;
+
+void uptime_init(TIM_HandleTypeDef* _htim_low, TIM_HandleTypeDef* _htim_high) {
+	htim_low = _htim_low;
+	htim_high = _htim_high;
+
+	// start the high half first so it can't miss the low half's first rollover
+	HAL_TIM_Base_Start(htim_high);
+	HAL_TIM_Base_Start(htim_low);
 }
 
-unsigned long uptime() {
-	unsigned int cnt;
-	unsigned long uptime_us_local;
-
-	// this loop is to catch a race condition where cnt rolls around to zero after reading uptime_us but before reading cnt
-	do {
-		uptime_us_local = uptime_us;
-		cnt = htim->Instance->CNT;
-	} while (uptime_us_local != uptime_us);
-
-	return uptime_us_local + cnt;
+uint64_t uptime() {
+	// read the high half on both sides of the low half.  if it changed in between, the low half rolled over
+	// somewhere in there, so read it again to go with the new high half.  the trigger reaches the high
+	// timer a couple of timer clocks after the rollover, sooner than the read of the low half
+	// takes, so a low half read just after a rollover is never paired with the high half from before it.
+	uint32_t high = htim_high->Instance->CNT;
+	uint32_t low = htim_low->Instance->CNT;
+	uint32_t high_again = htim_high->Instance->CNT;
+	if (high_again != high) {
+		high = high_again;
+		low = htim_low->Instance->CNT;
+	}
+	uint32_t count = (high << 16) | low;
+
+	if (count < last_count) {
+		rollovers++;
+	}
+	last_count = count;
+	return ((uint64_t)rollovers << 32) | count;
 }
 
 void sleep(unsigned int duration) {
-	unsigned long stop = uptime() + duration;
+	uint64_t stop = uptime() + duration;
 	while (uptime() < stop);
 }
-
-void uptime_int() {
-	uptime_us += 1000;
-}
@@ -0,0 +1,226 @@
+// planner micro-benchmark
+//
+// drives the real motion planner (motion.c) through each kind of move with the clock moving on one
+// microsecond per call, and times every call to motion_get_position_target_steps().  calls are grouped
+// by the phase the planner was in, so a change that only slows down, say, deceleration still shows.
+//
+// usage: planner_bench [-n calls_per_scenario]
+//
+// reports nanoseconds per call on this machine, and instructions per call where the kernel allows
+// reading the instruction counter.  make bench_emu builds it for the Cortex-M3 and runs it under QEMU
+// instead (see Host/emu), where it should report Cortex-M3 instructions per call.  that build hasn't
+// been compiled or run yet, so it's unverified; the host build is the one known to work.
+
+#define _GNU_SOURCE
+
+#include "motion.h"
+#include "command_table.h"
+#include "command_parser.h"
+
+#ifdef SIM_EMU
+#include "sim.h"
+#else
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PHASES (MOTION_PHASE_STOP + 1)
+
+static const char* const phase_names[PHASES] = { "rest", "accel", "cruise", "decel", "ramp", "stop" };
+
+typedef struct benchScenario {
+	const char* name;
+	const char* setup;       // commands before the clock starts
+	const char* command;     // the command that starts the move
+	double after_ms;         // when to send second, if there is one
+	const char* second;
+} benchScenario;
+
+// velocity and acceleration limits are chosen so every phase of every move gets plenty of calls
+static const benchScenario scenarios[] = {
+	{ "rest", "", "", 0, 0 },
+	{ "position", "mv=180 ma=360", "tp=270", 0, 0 },
+	{ "short move", "mv=180 ma=360", "tp=0.5", 0, 0 },
+	{ "velocity", "mv=180 ma=360", "tv=90", 0, 0 },
+	{ "reverse", "mv=180 ma=360", "tv=90", 500, "tv=-90" },
+	{ "stop first", "mv=180 ma=360", "tv=90", 500, "tp=0" },
+};
+
+typedef struct benchStats {
+	unsigned long calls;
+	double ns;
+	double instructions;
+} benchStats;
+
+static uint64_t now_us = 0;
+
+uint64_t uptime() { return now_us; }
+bool serial_write(const char* data, unsigned int len) { return true; }
+
+static void send(const char* commands) {
+	char copy[128];
+	strncpy(copy, commands, sizeof(copy) - 1);
+	copy[sizeof(copy) - 1] = 0;
+	for (char* text = strtok(copy, " "); text; text = strtok(0, " ")) {
+		motionCommand command = {{ text[0], text[1], 0 }, command_parse_decimal(text + 3, strlen(text + 3))};
+		command_dispatch(&command);
+	}
+}
+
+#ifdef SIM_EMU
+
+// the emulator's clock says nothing about the real core, but sim_cycles() counts its instructions
+
+static bool have_clock = false;
+
+static uint64_t clock_ns() {
+	return 0;
+}
+
+static int open_instruction_counter() {
+	return 0;
+}
+
+static uint64_t read_counter(int fd) {
+	return sim_cycles();
+}
+
+#else
+
+static bool have_clock = true;
+
+static uint64_t clock_ns() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int open_instruction_counter() {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t read_counter(int fd) {
+	uint64_t count = 0;
+	if (fd >= 0 && read(fd, &count, sizeof(count)) != sizeof(count)) {
+		count = 0;
+	}
+	return count;
+}
+
+#endif
+
+// the cost of the timing itself, taken off every call
+
+static void measure_overhead(int counter, double* ns, double* instructions) {
+	const int n = 1000000;
+	uint64_t total_ns = 0;
+	uint64_t total_instructions = 0;
+	for (int i = 0; i < n; i++) {
+		uint64_t i0 = read_counter(counter);
+		uint64_t t0 = clock_ns();
+		uint64_t t1 = clock_ns();
+		uint64_t i1 = read_counter(counter);
+		total_ns += t1 - t0;
+		// sim_cycles() is only 32 bits, so each count is taken as a 32-bit difference
+		total_instructions += (uint32_t)(i1 - i0);
+	}
+	*ns = (double)total_ns / n;
+	*instructions = (double)total_instructions / n;
+}
+
+static void run_scenario(const benchScenario* scenario, long calls, int counter, benchStats* stats) {
+	// start each scenario from scratch, at rest at 0
+	now_us = 0;
+	send("sr=25000 mv=90 ma=10");
+	motion_get_position_target_steps();
+	send("tv=0");
+	now_us += 1000000;
+	motion_get_position_target_steps();
+	send("tp=0");
+	now_us += 1000;
+	motion_get_position_target_steps();
+
+	send(scenario->setup);
+	send(scenario->command);
+	uint64_t second_at = now_us + scenario->after_ms * 1000;
+
+	memset(stats, 0, sizeof(benchStats) * PHASES);
+	for (long i = 0; i < calls; i++) {
+		now_us++;
+		if (scenario->second && now_us == second_at) {
+			send(scenario->second);
+		}
+		uint64_t i0 = read_counter(counter);
+		uint64_t t0 = clock_ns();
+		motion_get_position_target_steps();
+		uint64_t t1 = clock_ns();
+		uint64_t i1 = read_counter(counter);
+
+		benchStats* phase = &stats[motion_get_phase()];
+		phase->calls++;
+		phase->ns += t1 - t0;
+		phase->instructions += (uint32_t)(i1 - i0);
+	}
+}
+
+int main(int argc, char** argv) {
+	long calls = 4000000;
+	if (argc == 3 && strcmp(argv[1], "-n") == 0) {
+		calls = atol(argv[2]);
+	}
+	else if (argc != 1) {
+		fprintf(stderr, "usage: %s [-n calls_per_scenario]\n", argv[0]);
+		return 2;
+	}
+
+	motion_init();
+
+	int counter = open_instruction_counter();
+	double overhead_ns, overhead_instructions;
+	measure_overhead(counter, &overhead_ns, &overhead_instructions);
+
+	printf("%-12s %-7s %10s %10s %14s\n", "scenario", "phase", "calls", "ns/call", "instr/call");
+	for (unsigned int s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+		benchStats stats[PHASES];
+		run_scenario(&scenarios[s], calls, counter, stats);
+		for (int p = 0; p < PHASES; p++) {
+			if (stats[p].calls == 0) {
+				continue;
+			}
+			double ns = stats[p].ns / stats[p].calls - overhead_ns;
+			printf("%-12s %-7s %10lu ", scenarios[s].name, phase_names[p], stats[p].calls);
+			if (have_clock) {
+				printf("%10.1f ", ns > 0 ? ns : 0);
+			}
+			else {
+				printf("%10s ", "n/a");
+			}
+			if (counter >= 0) {
+				printf("%14.1f\n", stats[p].instructions / stats[p].calls - overhead_instructions);
+			}
+			else {
+				printf("%14s\n", "n/a");
+			}
+		}
+	}
+	if (have_clock) {
+		printf("timing overhead %.1f ns per call, taken off above\n", overhead_ns);
+	}
+	if (counter < 0) {
+		printf("instruction counter not available here (perf_event_open failed)\n");
+	}
+	return 0;
+}
@@ -0,0 +1,111 @@
+// host-side check of command_parse_decimal against strtod.
+// feeds it random strings in the form the command parser accepts, and compares the results, then times
+// both on the same inputs.
+
+#include "command_parser.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FUZZ_COUNT 1000000
+#define BENCH_COUNT 200000
+#define BENCH_REPEAT 20
+
+static unsigned long seed = 1;
+
+static unsigned long random_next() {
+	seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return seed >> 33;
+}
+
+// mostly well-formed numbers, with some stray '-' and '.' thrown in, like the parser lets through
+
+static int random_decimal(char* text) {
+	static const char chars[] = "0123456789-.";
+	int len = 0;
+	if (random_next() % 2) {
+		text[len++] = '-';
+	}
+	int whole = random_next() % 13;
+	for (int i = 0; i < whole; i++) {
+		text[len++] = '0' + random_next() % 10;
+	}
+	if (random_next() % 4) {
+		text[len++] = '.';
+		int fraction = random_next() % 10;
+		for (int i = 0; i < fraction; i++) {
+			text[len++] = '0' + random_next() % 10;
+		}
+	}
+	if (random_next() % 16 == 0) {
+		int extra = random_next() % 8;
+		for (int i = 0; i < extra && len < 31; i++) {
+			text[len++] = chars[random_next() % (sizeof(chars) - 1)];
+		}
+	}
+	text[len] = 0;
+	return len;
+}
+
+static double elapsed(struct timespec* start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+int main() {
+	char text[32];
+	int failures = 0;
+
+	for (int n = 0; n < FUZZ_COUNT; n++) {
+		int len = random_decimal(text);
+		double expected = strtod(text, NULL);
+		double got = (double)command_parse_decimal(text, len) / COMMAND_VALUE_SCALE;
+		// whole parts too large to fit saturate, so anything past the limit only needs to agree in sign
+		if (fabs(expected) >= COMMAND_WHOLE_MAX + 1.0) {
+			if (fabs(got) >= COMMAND_WHOLE_MAX && (got < 0) == (expected < 0)) {
+				continue;
+			}
+		}
+		// digits past the sixth decimal place are dropped, so allow up to one millionth, plus rounding in
+		// the double itself for large values
+		if (fabs(got - expected) > 1e-6 + fabs(expected) * 1e-15) {
+			if (failures++ < 10) {
+				printf("mismatch: \"%s\" strtod=%.9f parsed=%.9f\n", text, expected, got);
+			}
+		}
+	}
+	printf("fuzz: %d inputs, %d mismatches\n", FUZZ_COUNT, failures);
+
+	static char inputs[BENCH_COUNT][32];
+	static int lengths[BENCH_COUNT];
+	for (int n = 0; n < BENCH_COUNT; n++) {
+		lengths[n] = random_decimal(inputs[n]);
+	}
+
+	volatile double sink = 0;
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int r = 0; r < BENCH_REPEAT; r++) {
+		for (int n = 0; n < BENCH_COUNT; n++) {
+			sink += strtod(inputs[n], NULL);
+		}
+	}
+	double strtod_ns = elapsed(&start) * 1e9 / (BENCH_COUNT * BENCH_REPEAT);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int r = 0; r < BENCH_REPEAT; r++) {
+		for (int n = 0; n < BENCH_COUNT; n++) {
+			sink += (double)command_parse_decimal(inputs[n], lengths[n]) / COMMAND_VALUE_SCALE;
+		}
+	}
+	double parse_ns = elapsed(&start) * 1e9 / (BENCH_COUNT * BENCH_REPEAT);
+
+	printf("bench: strtod %.1f ns, command_parse_decimal %.1f ns per number\n", strtod_ns, parse_ns);
+
+	return failures != 0;
+}
@@ -0,0 +1,191 @@
+// replays a command script through the firmware, and reports the worst case cost of one main loop
+// iteration for each command and each motion phase, against the loop period DT_US.
+//
+// usage: budget [-t end_ms] [-c cycles_per_instruction] script
+//
+// the script is the same as stepsim's.  built for the emulator (make budget), costs are Cortex-M3
+// instructions; they're turned into cycles with a cycles-per-instruction figure, since QEMU doesn't
+// model the pipeline or flash wait states.  the default is a guess for this code running from flash at
+// 64 MHz; compare an iteration's instructions here with pr=1 on the board to pin it down.
+//
+// the emulator build hasn't been compiled or run yet: there's no ARM toolchain or QEMU where this was
+// written, so treat make budget as unverified until someone has it working.
+//
+// built for the host instead (make budget_host), costs are nanoseconds on the machine it runs on, and
+// -c defaults to the cycles the Cortex-M3 runs in one of them.  that says whether the loop would fit if
+// the core were as fast as the host, which it isn't, and it moves with whatever else the host is doing.
+// so it's only good for checking the harness itself, and only reports: it never fails the run.
+//
+// an iteration is put down to the last command it ran (- for none) and the phase the planner was in
+// when it finished.  the step engine's refill interrupt can land in any iteration, so its worst case is
+// added on top of each one's.  on the emulator, any that don't fit in DT_US fail the run.
+
+#include "sim.h"
+#include "main_real.h"
+#include "motion.h"
+#include "profile.h"
+#include "command_table.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUDGET_CPU_MHZ 64
+#define BUDGET_ROWS 64
+
+// what sim_cycles() counts, and how many cycles each one is taken as unless -c says otherwise
+#ifdef SIM_EMU
+#define BUDGET_UNIT "instruction"
+#define BUDGET_CYCLES_PER_UNIT 1.5
+#else
+#define BUDGET_UNIT "ns"
+#define BUDGET_CYCLES_PER_UNIT (BUDGET_CPU_MHZ / 1000.0)
+#endif
+
+static const char* const phase_names[MOTION_PHASE_STOP + 1] = { "rest", "accel", "cruise", "decel", "ramp", "stop" };
+
+typedef struct budgetRow {
+	char command[3];
+	motionPhase phase;
+	unsigned long count;
+	uint64_t total;
+	uint32_t worst;
+	uint64_t worst_time;
+} budgetRow;
+
+static budgetRow rows[BUDGET_ROWS];
+static int rows_len = 0;
+
+// the last command the current iteration ran
+static char loop_command[3] = "-";
+
+// see what each iteration runs (linked in with --wrap)
+
+bool __real_command_dispatch(motionCommand* command);
+
+bool __wrap_command_dispatch(motionCommand* command) {
+	loop_command[0] = command->command[0];
+	loop_command[1] = command->command[1];
+	loop_command[2] = 0;
+	return __real_command_dispatch(command);
+}
+
+static void count_loop(uint32_t cycles, uint64_t time) {
+	motionPhase phase = motion_get_phase();
+	budgetRow* row = 0;
+	for (int i = 0; i < rows_len; i++) {
+		if (rows[i].phase == phase && strcmp(rows[i].command, loop_command) == 0) {
+			row = &rows[i];
+			break;
+		}
+	}
+	if (!row) {
+		if (rows_len == BUDGET_ROWS) {
+			return;
+		}
+		row = &rows[rows_len++];
+		strcpy(row->command, loop_command);
+		row->phase = phase;
+	}
+	row->count++;
+	row->total += cycles;
+	if (cycles > row->worst) {
+		row->worst = cycles;
+		row->worst_time = time;
+	}
+	strcpy(loop_command, "-");
+}
+
+static void ignore_reply(const uint8_t* data, int len, uint64_t time) {
+}
+
+static uint64_t load_script(const char* path) {
+	FILE* file = fopen(path, "r");
+	if (!file) {
+		perror(path);
+		exit(2);
+	}
+	char line[256];
+	uint64_t last = 0;
+	while (fgets(line, sizeof(line), file)) {
+		double ms;
+		char command[200];
+		if (line[0] == '#' || sscanf(line, "%lf %199s", &ms, command) != 2) {
+			continue;
+		}
+		uint64_t time = ms * 1000;
+		strcat(command, "\n");
+		sim_receive((const uint8_t*)command, strlen(command), time);
+		sim_receive((const uint8_t*)command, strlen(command), time);
+		if (time > last) {
+			last = time;
+		}
+	}
+	fclose(file);
+	return last;
+}
+
+static int compare_rows(const void* a, const void* b) {
+	const budgetRow* row_a = a;
+	const budgetRow* row_b = b;
+	int order = strcmp(row_a->command, row_b->command);
+	return order ? order : (int)row_a->phase - (int)row_b->phase;
+}
+
+int main(int argc, char** argv) {
+	double end_ms = -1;
+	double cpi = BUDGET_CYCLES_PER_UNIT;
+	int opt = 1;
+	for (; opt < argc - 1; opt++) {
+		if (strcmp(argv[opt], "-t") == 0 && opt + 1 < argc - 1) {
+			end_ms = atof(argv[++opt]);
+		}
+		else if (strcmp(argv[opt], "-c") == 0 && opt + 1 < argc - 1) {
+			cpi = atof(argv[++opt]);
+		}
+		else {
+			break;
+		}
+	}
+	if (opt != argc - 1) {
+		fprintf(stderr, "usage: %s [-t end_ms] [-c cycles_per_instruction] script\n", argc ? argv[0] : "budget");
+		return 2;
+	}
+
+	sim_set_tx_handler(ignore_reply);
+	sim_set_loop_handler(count_loop);
+	sim_init();
+	uint64_t last = load_script(argv[opt]);
+	uint64_t end = end_ms >= 0 ? (uint64_t)(end_ms * 1000) : last + 1000000;
+	sim_run(end);
+
+	uint32_t budget = DT_US * BUDGET_CPU_MHZ;
+	uint32_t refill = profile_stats[PROFILE_REFILL].max * cpi;
+	printf("loop budget %u cycles (%d us at %d MHz), %.3f cycles per %s\n", budget, DT_US, BUDGET_CPU_MHZ, cpi, BUDGET_UNIT);
+	printf("refill interrupt worst %lu %s, %u cycles, added to each row\n",
+			(unsigned long)profile_stats[PROFILE_REFILL].max, SIM_CYCLE_UNITS, refill);
+	printf("%-4s %-7s %9s %10s %10s %8s %6s %12s\n", "cmd", "phase", "loops", "mean", "worst", "cycles", "used", "worst at ms");
+
+	qsort(rows, rows_len, sizeof(budgetRow), compare_rows);
+	int over = 0;
+	for (int i = 0; i < rows_len; i++) {
+		budgetRow* row = &rows[i];
+		uint32_t cycles = row->worst * cpi + refill;
+		bool fits = cycles <= budget;
+		printf("%-4s %-7s %9lu %10lu %10lu %8lu %5.0f%% %12.3f%s\n", row->command, phase_names[row->phase],
+				row->count, (unsigned long)(row->total / row->count), (unsigned long)row->worst,
+				(unsigned long)cycles, 100.0 * cycles / budget, row->worst_time / 1000.0, fits ? "" : "  over");
+		if (!fits) {
+			over++;
+		}
+	}
+#ifdef SIM_EMU
+	if (over) {
+		printf("%d over budget\n", over);
+		return 1;
+	}
+#else
+	printf("host nanoseconds, not the Cortex-M3: for checking the harness only, not a pass or fail\n");
+#endif
+	return 0;
+}
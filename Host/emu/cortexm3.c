@@ -0,0 +1,131 @@
+// start-up and the cycle counter for running the simulator on a Cortex-M3, under QEMU's mps2-an385
+// board.  everything but the heap and stack is linked into the board's 4 MB of RAM at 0 (see mps2.ld),
+// so there's nothing to copy at reset, and stdio and the command line come from the host through
+// semihosting.
+//
+// QEMU isn't cycle-accurate, but run with -icount shift=EMU_SHIFT every instruction takes exactly
+// 2^EMU_SHIFT ns of virtual time.  SysTick runs off the board's 25 MHz clock in that virtual time, so
+// counting its ticks counts instructions: 40 ns per tick, 0.625 instructions per tick at shift 6.
+
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef EMU_SHIFT
+#define EMU_SHIFT 6
+#endif
+
+#define EMU_SYSTICK_HZ 25000000
+#define EMU_CMDLINE_LEN 256
+#define EMU_MAX_ARGS 16
+
+#define SYST_CSR (*(volatile uint32_t*)0xe000e010)
+#define SYST_RVR (*(volatile uint32_t*)0xe000e014)
+#define SYST_CVR (*(volatile uint32_t*)0xe000e018)
+
+#define SYS_GET_CMDLINE 0x15
+#define SYS_EXIT 0x18
+#define ADP_STOPPED_RUNTIME_ERROR 0x20023
+#define ADP_STOPPED_APPLICATION_EXIT 0x20026
+
+extern uint32_t __bss_start__;
+extern uint32_t __bss_end__;
+extern uint32_t __stack_top;
+
+void initialise_monitor_handles();
+void __libc_init_array();
+int main(int argc, char** argv);
+
+static int semihost(int operation, void* argument) {
+	register int r0 __asm__("r0") = operation;
+	register void* r1 __asm__("r1") = argument;
+	__asm__ volatile ("bkpt 0xab" : "+r"(r0) : "r"(r1) : "memory");
+	return r0;
+}
+
+// the only way out of QEMU that reliably carries pass or fail back to make
+
+static void emu_exit(int status) {
+	fflush(stdout);
+	semihost(SYS_EXIT, (void*)(status == 0 ? ADP_STOPPED_APPLICATION_EXIT : ADP_STOPPED_RUNTIME_ERROR));
+	while (1) ;
+}
+
+// instructions since reset.  SysTick is 24 bits, so this has to be read at least every 16.7M ticks,
+// which the simulation does all the time.
+
+static uint32_t systick_last = 0xffffff;
+static uint64_t systick_ticks = 0;
+
+uint32_t sim_cycles() {
+	uint32_t now = SYST_CVR;
+	systick_ticks += (systick_last - now) & 0xffffff;
+	systick_last = now;
+	return (systick_ticks * (1000000000 / EMU_SYSTICK_HZ)) >> EMU_SHIFT;
+}
+
+// the command line comes as one string, split at spaces
+
+static int emu_args(char** argv) {
+	static char cmdline[EMU_CMDLINE_LEN];
+	struct {
+		char* buffer;
+		int len;
+	} block = { cmdline, sizeof(cmdline) };
+	int argc = 0;
+	if (semihost(SYS_GET_CMDLINE, &block) != 0) {
+		return 0;
+	}
+	for (char* c = cmdline; *c && argc < EMU_MAX_ARGS; ) {
+		while (*c == ' ') {
+			*c++ = 0;
+		}
+		if (*c) {
+			argv[argc++] = c;
+		}
+		while (*c && *c != ' ') {
+			c++;
+		}
+	}
+	return argc;
+}
+
+// no C runtime start files are linked, so these are here for __libc_init_array()
+
+void _init() {}
+void _fini() {}
+
+void Reset_Handler() {
+	for (uint32_t* word = &__bss_start__; word < &__bss_end__; word++) {
+		*word = 0;
+	}
+
+	// SysTick from the processor clock, free running over its whole range
+	SYST_RVR = 0xffffff;
+	SYST_CVR = 0;
+	SYST_CSR = 5;
+
+	initialise_monitor_handles();
+	__libc_init_array();
+
+	static char* argv[EMU_MAX_ARGS + 1];
+	int argc = emu_args(argv);
+	emu_exit(main(argc, argv));
+}
+
+static void Fault_Handler() {
+	printf("fault\n");
+	emu_exit(1);
+}
+
+__attribute__((section(".isr_vector"), used))
+static void (* const vectors[16])() = {
+	(void (*)())&__stack_top,
+	Reset_Handler,
+	Fault_Handler, // NMI
+	Fault_Handler, // hard fault
+	Fault_Handler, // memory management
+	Fault_Handler, // bus fault
+	Fault_Handler, // usage fault
+};
@@ -0,0 +1,181 @@
+// host-side check of the binary frame protocol's ACK/NAK handling in command_runner.c.
+// frames are fed in through a stubbed serial port, and the replies and commands that come out are
+// checked against what command_frame.h promises the host: frames taken in order and ACKed, a NAK for a
+// damaged frame, a frame whose command isn't two lowercase letters, or a gap, the numbering wrapping
+// from 255 to 0, and a re-ACK for a frame sent twice.
+
+#include "command_runner.h"
+#include "command_frame.h"
+#include "command_table.h"
+#include "serial.h"
+
+#include <stdio.h>
+
+// the serial port: bytes to read, and the replies written back
+
+static uint8_t input[1024];
+static int input_len = 0;
+static int input_pos = 0;
+
+static uint8_t output[1024];
+static int output_len = 0;
+
+bool serial_read_char(char* c) {
+	if (input_pos == input_len) {
+		return false;
+	}
+	*c = input[input_pos++];
+	return true;
+}
+
+bool serial_write(const char* data, unsigned int len) { return true; }
+bool serial_print(const char* text) { return true; }
+bool serial_rx_lost() { return false; }
+void serial_confirm_baud() {}
+
+uint8_t* serial_reserve(unsigned int len) {
+	return output_len + len <= sizeof(output) ? &output[output_len] : 0;
+}
+
+void serial_commit(uint8_t* data, unsigned int len) {
+	output_len += len;
+}
+
+static int checks = 0;
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+	checks++;
+	if (!ok) {
+		failures++;
+		printf("failed: %s\n", what);
+	}
+}
+
+// queues one frame for <code>=<value thousandths>, optionally with one byte of it damaged
+
+static void send_command_frame(const char* code, uint8_t sequence, int32_t value, bool damaged) {
+	uint8_t* frame = &input[input_len];
+	frame[0] = COMMAND_FRAME_SYNC;
+	frame[1] = code[0];
+	frame[2] = code[1];
+	frame[3] = value;
+	frame[4] = value >> 8;
+	frame[5] = value >> 16;
+	frame[6] = value >> 24;
+	frame[7] = sequence;
+	uint16_t crc = command_frame_crc(frame + 1, 7);
+	frame[8] = crc;
+	frame[9] = crc >> 8;
+	if (damaged) {
+		frame[4] ^= 0x10;
+	}
+	input_len += COMMAND_FRAME_LEN;
+}
+
+static void send_frame(uint8_t sequence, int32_t value, bool damaged) {
+	send_command_frame("tp", sequence, value, damaged);
+}
+
+// runs the command runner over everything queued.  returns how many commands came out, with the value
+// of the last one, and leaves the replies in output.
+
+static int run(int64_t* last_value) {
+	output_len = 0;
+	int commands = 0;
+	motionCommand command;
+	while (poll_new_command(&command)) {
+		commands++;
+		*last_value = command.value;
+	}
+	input_len = 0;
+	input_pos = 0;
+	return commands;
+}
+
+// whether reply number n is the given type and sequence number, with a good CRC
+
+static bool reply_is(int n, uint8_t type, uint8_t sequence) {
+	const uint8_t* reply = &output[n * COMMAND_REPLY_LEN];
+	if ((n + 1) * COMMAND_REPLY_LEN > output_len) {
+		return false;
+	}
+	uint16_t crc = command_frame_crc(reply + 1, 2);
+	return reply[0] == COMMAND_REPLY_SYNC && reply[1] == type && reply[2] == sequence &&
+			reply[3] == (uint8_t)crc && reply[4] == (uint8_t)(crc >> 8);
+}
+
+static int replies() {
+	return output_len / COMMAND_REPLY_LEN;
+}
+
+int main() {
+	command_table_init();
+	command_runner_init();
+
+	motionCommand binary = {{ 'p', 'm', 0 }, COMMAND_VALUE(1)};
+	command_dispatch(&binary);
+
+	int64_t value = 0;
+
+	// in order: each frame is taken and ACKed, and the first one sets the numbering
+	send_frame(10, 1000, false);
+	send_frame(11, 2000, false);
+	send_frame(12, -2500, false);
+	check(run(&value) == 3, "in order: three commands");
+	check(value == -2500 * (COMMAND_VALUE_SCALE / COMMAND_FRAME_SCALE), "in order: value");
+	check(replies() == 3 && reply_is(0, COMMAND_REPLY_ACK, 10) && reply_is(1, COMMAND_REPLY_ACK, 11) &&
+			reply_is(2, COMMAND_REPLY_ACK, 12), "in order: ACK 10, 11, 12");
+
+	// damaged: the frame is dropped and NAKed, and taken when it comes again
+	send_frame(13, 3000, true);
+	check(run(&value) == 0, "damaged: no command");
+	check(replies() == 1 && reply_is(0, COMMAND_REPLY_NAK, 13), "damaged: NAK 13");
+	send_frame(13, 3000, false);
+	check(run(&value) == 1 && value == 3 * COMMAND_VALUE_SCALE, "damaged: resent frame taken");
+	check(replies() == 1 && reply_is(0, COMMAND_REPLY_ACK, 13), "damaged: ACK 13");
+
+	// bad command: a good CRC around a code that isn't two lowercase letters is NAKed like a damaged
+	// frame, and never reaches the command table
+	send_command_frame("TP", 14, 4000, false);
+	send_command_frame("\x01\x02", 14, 4000, false);
+	check(run(&value) == 0, "bad command: no command");
+	check(replies() == 1 && reply_is(0, COMMAND_REPLY_NAK, 14), "bad command: NAK 14");
+	send_frame(14, 4000, false);
+	check(run(&value) == 1 && value == 4 * COMMAND_VALUE_SCALE, "bad command: good frame taken");
+	check(replies() == 1 && reply_is(0, COMMAND_REPLY_ACK, 14), "bad command: ACK 14");
+
+	// gap: frame 15 goes missing, so 16 and 17 are dropped with one NAK for 15 between them
+	send_frame(16, 6000, false);
+	send_frame(17, 7000, false);
+	check(run(&value) == 0, "gap: no commands");
+	check(replies() == 1 && reply_is(0, COMMAND_REPLY_NAK, 15), "gap: one NAK 15");
+	send_frame(15, 5000, false);
+	send_frame(16, 6000, false);
+	send_frame(17, 7000, false);
+	check(run(&value) == 3 && value == 7 * COMMAND_VALUE_SCALE, "gap: resent frames taken");
+	check(replies() == 3 && reply_is(0, COMMAND_REPLY_ACK, 15) && reply_is(2, COMMAND_REPLY_ACK, 17),
+			"gap: ACK 15 to 17");
+
+	// wrap: the numbering goes on from 255 to 0
+	for (int sequence = 18; sequence <= 255; sequence++) {
+		send_frame(sequence, sequence, false);
+		run(&value);
+	}
+	send_frame(0, 7000, false);
+	send_frame(1, 8000, false);
+	check(run(&value) == 2 && value == 8 * COMMAND_VALUE_SCALE, "wrap: frames 0 and 1 taken");
+	check(replies() == 2 && reply_is(0, COMMAND_REPLY_ACK, 0) && reply_is(1, COMMAND_REPLY_ACK, 1),
+			"wrap: ACK 0, 1");
+
+	// duplicate: a frame we already have means its ACK was lost, so the last one is sent again.  255 is
+	// from before the wrap, so it's old too, not 253 frames ahead.
+	send_frame(0, 7000, false);
+	send_frame(255, 255, false);
+	check(run(&value) == 0, "duplicate: no command");
+	check(replies() == 2 && reply_is(0, COMMAND_REPLY_ACK, 1) && reply_is(1, COMMAND_REPLY_ACK, 1),
+			"duplicate: ACK 1 again for 0 and 255");
+
+	printf("frames: %d checks, %d failures\n", checks, failures);
+	return failures != 0;
+}
@@ -0,0 +1,214 @@
+// host-side check of the fixed-point motion planner against a floating point one.
+// the reference below is the original float planner, in double precision and in degrees, with the same
+// rules for when a new move starts and when it has to stop first.  like the fixed-point one, it takes
+// the limits when a move is planned, so mv/ma only change the moves after them.  random mv/ma/sr/tp/tv commands are
+// sent to both, and the step targets have to agree to within a step at every tick.
+
+#include "motion.h"
+#include "command_table.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_COMMANDS 4000
+#define TEST_TICK_US 50
+#define TEST_TOLERANCE 1
+
+static unsigned long seed = 1;
+
+static unsigned long random_next() {
+	seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return seed >> 33;
+}
+
+static double random_range(double min, double max) {
+	return min + (max - min) * (random_next() % 1000001) / 1000000.0;
+}
+
+// the firmware's clock, and the one function motion.c needs from the serial port (for hl=)
+
+static uint64_t now_us = 0;
+
+uint64_t uptime() { return now_us; }
+bool serial_write(const char* data, unsigned int len) { return true; }
+
+// reference planner
+
+static double vl = 90;
+static double al = 10;
+static int steps_per_rev = 25000;
+
+// the limits the current move (or ramp) was planned with
+static double move_vl = 90;
+static double move_al = 10;
+
+static double pf = 0;
+static double vf = 0;
+static double t0 = 0;
+static double p0 = 0;
+static double v0 = 0;
+static double t_now = 0;
+static bool target_p_mode = true;
+static bool stop_needed = false;
+static double p_cmd = 0;
+static double v_cmd = 0;
+
+static void reference_position(double t) {
+	double vl = move_vl;
+	double al = move_al;
+	double t01 = vl / al;
+	double a = (pf > p0 ? 1 : -1) * al;
+	double v = (pf > p0 ? 1 : -1) * vl;
+	double p01 = 0.5 * a * t01 * t01;
+	double p12 = pf - p0 - 2 * p01;
+	if (fabs(p01) > 0.5 * fabs(pf - p0)) {
+		p01 = 0.5 * (pf - p0);
+		p12 = 0;
+		t01 = sqrt(2 * p01 / a);
+	}
+	double t1 = t01;
+	double t2 = t1 + fabs(p12) / vl;
+	double t3 = t2 + t01;
+	double v1 = a * t01;
+
+	if (t > t3) {
+		v_cmd = 0;
+		p_cmd = pf;
+	}
+	else if (t > t2) {
+		t -= t2;
+		v_cmd = v1 - a * t;
+		p_cmd = p0 + p01 + p12 + v1 * t - 0.5 * a * t * t;
+	}
+	else if (t > t1) {
+		t -= t1;
+		v_cmd = v;
+		p_cmd = p0 + p01 + v * t;
+	}
+	else {
+		v_cmd = a * t;
+		p_cmd = p0 + 0.5 * a * t * t;
+	}
+}
+
+static void reference_evaluate(double now) {
+	if (now < t0) {
+		now = t0;
+	}
+	t_now = now;
+	double t = now - t0;
+
+	if (target_p_mode && !stop_needed) {
+		reference_position(t);
+		return;
+	}
+
+	double v_tgt = stop_needed ? 0 : vf;
+	double a = (v_tgt > v0 ? 1 : -1) * move_al;
+	double tc = fabs(v_tgt - v0) / move_al;
+	double pc = p0 + v0 * tc + 0.5 * a * tc * tc;
+	if (t > tc) {
+		v_cmd = v_tgt;
+		p_cmd = pc + v_tgt * (t - tc);
+	}
+	else {
+		v_cmd = v0 + a * t;
+		p_cmd = p0 + v0 * t + 0.5 * a * t * t;
+	}
+
+	if (stop_needed && t > tc) {
+		stop_needed = false;
+		t0 += tc;
+		p0 = pc;
+		v0 = 0;
+		move_vl = vl;
+		move_al = al;
+		reference_position(now - t0);
+	}
+}
+
+static void reference_command(const char* command, double value) {
+	if (command[0] == 'm' && command[1] == 'v') {
+		vl = value;
+	}
+	else if (command[0] == 'm' && command[1] == 'a') {
+		al = value;
+	}
+	else if (command[0] == 's' && command[1] == 'r') {
+		steps_per_rev = value;
+	}
+	else {
+		t0 = t_now;
+		p0 = p_cmd;
+		v0 = v_cmd;
+		move_vl = vl;
+		move_al = al;
+		target_p_mode = command[1] == 'p';
+		if (target_p_mode) {
+			pf = value;
+			vf = 0;
+			stop_needed = v0 != 0;
+		}
+		else {
+			vf = value;
+			pf = 0;
+			stop_needed = false;
+		}
+	}
+}
+
+static void send(const char* command, double value) {
+	motionCommand firmware = {{ command[0], command[1], 0 }, llround(value * COMMAND_VALUE_SCALE)};
+	command_dispatch(&firmware);
+	reference_command(command, value);
+}
+
+int main() {
+	command_table_init();
+	motion_init();
+
+	unsigned long ticks = 0;
+	unsigned long mismatches = 0;
+	int worst = 0;
+	for (int i = 0; i < TEST_COMMANDS; i++) {
+		unsigned long choice = random_next() % 16;
+		if (choice == 0) {
+			send("mv", round(random_range(1, 720) * 1000) / 1000);
+		}
+		else if (choice == 1) {
+			send("ma", round(random_range(1, 3600) * 1000) / 1000);
+		}
+		else if (choice == 2) {
+			static const int resolutions[] = { 200, 3200, 25000, 51200 };
+			send("sr", resolutions[random_next() % 4]);
+		}
+		else if (choice < 10) {
+			// mostly whole moves, with some tiny ones for the short move branch
+			double target = random_next() % 4 ? random_range(-720, 720) : p_cmd + random_range(-0.5, 0.5);
+			send("tp", round(target * 1000) / 1000);
+		}
+		else {
+			send("tv", round(random_range(-360, 360) * 1000) / 1000);
+		}
+
+		unsigned long hold = 1000 + random_next() % 3000000;
+		for (unsigned long t = 0; t < hold; t += TEST_TICK_US) {
+			now_us += TEST_TICK_US;
+			int firmware = motion_get_position_target_steps();
+			reference_evaluate(now_us / 1e6);
+			int reference = p_cmd / 360.0 * steps_per_rev;
+			int error = abs(firmware - reference);
+			if (error > worst) {
+				worst = error;
+			}
+			if (error > TEST_TOLERANCE && mismatches++ < 10) {
+				printf("mismatch at %.6f s: fixed %d, float %d\n", now_us / 1e6, firmware, reference);
+			}
+			ticks++;
+		}
+	}
+
+	printf("motion: %lu ticks, %lu mismatches, worst difference %d steps\n", ticks, mismatches, worst);
+	return mismatches != 0;
+}
@@ -0,0 +1,418 @@
+#include "sim.h"
+#include "main.h"
+#include "main_real.h"
+#include "uptime.h"
+#include "profile.h"
+#include "serial.h"
+#include "stepgen.h"
+
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// the handles main.c would set up
+TIM_HandleTypeDef htim1;
+TIM_HandleTypeDef htim2;
+TIM_HandleTypeDef htim3;
+DMA_HandleTypeDef hdma_tim1_ch1;
+DMA_HandleTypeDef hdma_tim1_ch2;
+UART_HandleTypeDef huart1;
+DMA_HandleTypeDef hdma_usart1_rx;
+DMA_HandleTypeDef hdma_usart1_tx;
+
+TIM_TypeDef sim_tim1;
+TIM_TypeDef sim_tim2;
+TIM_TypeDef sim_tim3;
+USART_TypeDef sim_usart1;
+GPIO_TypeDef sim_gpioa;
+GPIO_TypeDef sim_gpiob;
+CoreDebug_Type sim_core_debug;
+DWT_Type sim_dwt_regs;
+
+uint64_t sim_time = 0;
+static uint64_t sim_end_time = UINT64_MAX;
+static jmp_buf sim_exit;
+
+simStep* sim_steps = 0;
+int sim_steps_len = 0;
+static int sim_steps_cap = 0;
+static int sim_position = 0;
+
+simDirection* sim_directions = 0;
+int sim_directions_len = 0;
+static int sim_directions_cap = 0;
+
+simSample* sim_samples = 0;
+int sim_samples_len = 0;
+static int sim_samples_cap = 0;
+
+static simTxHandler tx_handler = 0;
+static simPollHandler poll_handler = 0;
+static simLoopHandler loop_handler = 0;
+static uint32_t wire_limit = 0;
+
+// cycles spent simulating the hardware, which the firmware's cycle counter leaves out.  interrupt
+// callbacks run from inside the simulation, but they're firmware, so they're counted.
+static uint32_t hw_cycles = 0;
+
+// the profiler's loop section, as of the last iteration reported
+static uint32_t loop_count = 0;
+static uint64_t loop_total = 0;
+
+// the step engine's ring, as laid out in stepgen.c
+typedef struct simSlot {
+	uint16_t arr;
+	uint16_t rcr;
+	uint16_t ccr1;
+} simSlot;
+extern simSlot ring[STEPGEN_RING_LEN];
+extern uint32_t ring_dir[STEPGEN_RING_LEN];
+
+// TIM1: the period being played (shadow registers), the one loaded for next (preload registers), and
+// where the two DMA channels are in their rings
+static bool tim_running = false;
+static uint64_t tim_period_start = 0;
+static simSlot tim_shadow;
+static simSlot tim_preload;
+static unsigned int tim_repeat = 0;
+static unsigned int dma_slot = 0;
+static unsigned int dma_dir = 0;
+
+// USART1 receive: bytes waiting to arrive, and where the DMA is in the firmware's buffer
+typedef struct simByte {
+	uint64_t time;
+	uint8_t data;
+} simByte;
+static simByte* rx_queue = 0;
+static int rx_queue_len = 0;
+static int rx_queue_cap = 0;
+static int rx_queue_pos = 0;
+static uint8_t* rx_buffer = 0;
+static uint16_t rx_size = 0;
+
+// USART1 transmit: the run the DMA is sending, and when it's done
+static const uint8_t* tx_data = 0;
+static uint16_t tx_len = 0;
+static uint64_t tx_done = 0;
+
+static void* sim_grow(void* array, int* cap, int len, size_t size) {
+	if (len < *cap) {
+		return array;
+	}
+	*cap = *cap ? *cap * 2 : 4096;
+	return realloc(array, *cap * size);
+}
+
+uint32_t sim_baud() {
+	return huart1.Init.BaudRate;
+}
+
+void sim_set_wire_limit(uint32_t baud) {
+	wire_limit = baud;
+}
+
+// microseconds per byte on the wire, with a start and stop bit, rounded up
+static uint64_t sim_byte_time() {
+	uint32_t baud = sim_baud();
+	if (wire_limit != 0 && wire_limit < baud) {
+		baud = wire_limit;
+	}
+	return (10 * 1000000 + baud - 1) / baud;
+}
+
+// hardware
+
+// a GPIO port's outputs change, at the given tick.  changes of the direction pin (PB3) are recorded.
+
+static void sim_gpio(GPIO_TypeDef* port, uint32_t odr, uint64_t tick) {
+	if (port == &sim_gpiob && ((port->ODR ^ odr) & GPIO_PIN_3)) {
+		simDirection* change;
+		sim_directions = sim_grow(sim_directions, &sim_directions_cap, sim_directions_len, sizeof(simDirection));
+		change = &sim_directions[sim_directions_len++];
+		change->tick = tick;
+		change->direction = (odr & GPIO_PIN_3) ? 1 : -1;
+	}
+	port->ODR = odr;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* port, uint16_t pin, GPIO_PinState state) {
+	uint32_t odr = state == GPIO_PIN_SET ? port->ODR | pin : port->ODR & ~pin;
+	sim_gpio(port, odr, sim_time * SIM_TICKS_PER_US);
+}
+
+static void sim_bsrr(GPIO_TypeDef* port, uint32_t bsrr, uint64_t tick) {
+	sim_gpio(port, (port->ODR & ~(bsrr >> 16)) | (bsrr & 0xFFFF), tick);
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef* htim, uint32_t channel) { return HAL_OK; }
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef* htim) { return HAL_OK; }
+HAL_StatusTypeDef HAL_DMA_Start(DMA_HandleTypeDef* hdma, uint32_t src, uint32_t dst, uint32_t len) { return HAL_OK; }
+HAL_StatusTypeDef HAL_DMA_Start_IT(DMA_HandleTypeDef* hdma, uint32_t src, uint32_t dst, uint32_t len) { return HAL_OK; }
+uint32_t HAL_RCC_GetPCLK2Freq() { return 16000000; }
+
+#ifndef SIM_EMU
+uint32_t sim_cycles() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t)(now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+#endif
+
+// reading the counter takes a little time too, which is left out after the read
+
+DWT_Type* sim_dwt() {
+	uint32_t start = sim_cycles();
+	sim_dwt_regs.CYCCNT = start - hw_cycles;
+	hw_cycles += sim_cycles() - start;
+	return &sim_dwt_regs;
+}
+
+static void sim_firmware_end(uint32_t start) {
+	hw_cycles -= sim_cycles() - start;
+}
+
+// only the step engine's use of TIM1 is modelled: PWM mode 2 with the DMA feeding the ring in
+
+void sim_tim_enable(TIM_HandleTypeDef* htim) {
+	if (htim != &htim1) {
+		return;
+	}
+	TIM_TypeDef* tim = htim->Instance;
+	tim_running = true;
+	tim_period_start = sim_time * SIM_TICKS_PER_US;
+	tim_shadow.arr = tim->ARR;
+	tim_shadow.rcr = tim->RCR;
+	tim_shadow.ccr1 = tim->CCR1;
+	tim_preload = tim_shadow;
+	tim_repeat = tim_shadow.rcr;
+}
+
+void sim_tim_disable(TIM_HandleTypeDef* htim) {
+	if (htim == &htim1) {
+		tim_running = false;
+	}
+}
+
+static void sim_step(uint64_t tick) {
+	simStep* step;
+	sim_steps = sim_grow(sim_steps, &sim_steps_cap, sim_steps_len, sizeof(simStep));
+	step = &sim_steps[sim_steps_len++];
+	step->tick = tick;
+	step->direction = (sim_gpiob.ODR & GPIO_PIN_3) ? 1 : -1;
+	step->enabled = !(sim_gpiob.ODR & GPIO_PIN_4);
+	sim_position += step->direction;
+	step->position = sim_position;
+}
+
+// play TIM1 periods that end by the given tick
+
+static void sim_tim(uint64_t tick) {
+	while (tim_running && tim_period_start + tim_shadow.arr + 1 <= tick) {
+		// PWM mode 2: the output goes high when the count reaches CCR1
+		if (tim_shadow.ccr1 <= tim_shadow.arr) {
+			sim_step(tim_period_start + tim_shadow.ccr1);
+		}
+		tim_period_start += tim_shadow.arr + 1;
+		if (tim_repeat > 0) {
+			tim_repeat--;
+			continue;
+		}
+
+		// update event: the preload registers take effect, and both DMA requests fire
+		tim_shadow = tim_preload;
+		tim_repeat = tim_shadow.rcr;
+		tim_preload = ring[dma_slot];
+		sim_bsrr(&sim_gpiob, ring_dir[dma_dir], tim_period_start);
+		dma_dir = (dma_dir + 1) % STEPGEN_RING_LEN;
+		dma_slot++;
+		if (dma_slot == STEPGEN_RING_LEN / 2 && hdma_tim1_ch2.XferHalfCpltCallback) {
+			uint32_t start = sim_cycles();
+			hdma_tim1_ch2.XferHalfCpltCallback(&hdma_tim1_ch2);
+			sim_firmware_end(start);
+		}
+		if (dma_slot == STEPGEN_RING_LEN) {
+			dma_slot = 0;
+			if (hdma_tim1_ch2.XferCpltCallback) {
+				uint32_t start = sim_cycles();
+				hdma_tim1_ch2.XferCpltCallback(&hdma_tim1_ch2);
+				sim_firmware_end(start);
+			}
+		}
+	}
+}
+
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef* huart, uint8_t* data, uint16_t size) {
+	rx_buffer = data;
+	rx_size = size;
+	huart->hdmarx->remaining = size;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef* huart, const uint8_t* data, uint16_t size) {
+	if (tx_len != 0) {
+		return HAL_BUSY;
+	}
+	tx_data = data;
+	tx_len = size;
+	tx_done = sim_time + size * sim_byte_time();
+	return HAL_OK;
+}
+
+void sim_receive(const uint8_t* data, int len, uint64_t time) {
+	uint64_t last = rx_queue_len > rx_queue_pos ? rx_queue[rx_queue_len - 1].time : 0;
+	if (time < last) {
+		time = last;
+	}
+	for (int i = 0; i < len; i++) {
+		time += sim_byte_time();
+		rx_queue = sim_grow(rx_queue, &rx_queue_cap, rx_queue_len, sizeof(simByte));
+		rx_queue[rx_queue_len].time = time;
+		rx_queue[rx_queue_len].data = data[i];
+		rx_queue_len++;
+	}
+}
+
+int sim_receive_room(uint64_t time, uint64_t window) {
+	uint64_t last = rx_queue_len > rx_queue_pos ? rx_queue[rx_queue_len - 1].time : 0;
+	if (last < time) {
+		last = time;
+	}
+	if (last >= time + window) {
+		return 0;
+	}
+	return (time + window - last) / sim_byte_time();
+}
+
+static void sim_serial() {
+	bool received = false;
+	while (rx_queue_pos < rx_queue_len && rx_queue[rx_queue_pos].time <= sim_time && rx_buffer) {
+		DMA_HandleTypeDef* hdma = huart1.hdmarx;
+		rx_buffer[rx_size - hdma->remaining] = rx_queue[rx_queue_pos++].data;
+		if (--hdma->remaining == 0) {
+			hdma->remaining = rx_size;
+		}
+		received = true;
+	}
+	if (received) {
+		uint32_t start = sim_cycles();
+		HAL_UARTEx_RxEventCallback(&huart1, rx_size - huart1.hdmarx->remaining);
+		sim_firmware_end(start);
+	}
+
+	if (tx_len != 0 && sim_time >= tx_done) {
+		uint8_t data[SERIAL_TX_LEN];
+		int len = tx_len;
+		memcpy(data, tx_data, len);
+		tx_len = 0;
+		if (tx_handler) {
+			tx_handler(data, len, sim_time);
+		}
+		uint32_t start = sim_cycles();
+		HAL_UART_TxCpltCallback(&huart1);
+		sim_firmware_end(start);
+	}
+}
+
+// the first time is read after an iteration ends is in the next one's wait, which is where each
+// iteration gets reported.  an iteration that reset the profiler (pr=0) isn't.
+
+static void sim_loop() {
+	profileStats* stats = &profile_stats[PROFILE_LOOP];
+	if (stats->count == loop_count) {
+		return;
+	}
+	if (stats->count == loop_count + 1 && loop_handler) {
+		loop_handler((uint32_t)(stats->total - loop_total), sim_time);
+	}
+	loop_count = stats->count;
+	loop_total = stats->total;
+}
+
+// move virtual time on to the given microsecond, running the hardware as it goes
+
+static void sim_advance(uint64_t time) {
+	uint32_t start = sim_cycles();
+	sim_loop();
+	while (sim_time < time) {
+		sim_time++;
+		sim_tim(sim_time * SIM_TICKS_PER_US);
+		sim_serial();
+		if (poll_handler && sim_time % 1000 == 0) {
+			poll_handler(sim_time);
+		}
+		if (sim_time >= sim_end_time) {
+			longjmp(sim_exit, 1);
+		}
+	}
+	hw_cycles += sim_cycles() - start;
+}
+
+// virtual time
+
+void uptime_init(TIM_HandleTypeDef* _htim_low, TIM_HandleTypeDef* _htim_high) {
+}
+
+uint64_t uptime() {
+	sim_advance(sim_time + 1);
+	return sim_time;
+}
+
+void sleep(unsigned int duration) {
+	sim_advance(sim_time + duration);
+}
+
+// record every planner sample the step engine takes (linked in with --wrap)
+
+fix_pos __real_motion_get_position_target_at(uint64_t now);
+
+fix_pos __wrap_motion_get_position_target_at(uint64_t now) {
+	fix_pos position = __real_motion_get_position_target_at(now);
+	sim_samples = sim_grow(sim_samples, &sim_samples_cap, sim_samples_len, sizeof(simSample));
+	sim_samples[sim_samples_len].time = now;
+	sim_samples[sim_samples_len].position = position;
+	sim_samples_len++;
+	return position;
+}
+
+// set up
+
+void sim_set_tx_handler(simTxHandler handler) {
+	tx_handler = handler;
+}
+
+void sim_set_poll_handler(simPollHandler handler) {
+	poll_handler = handler;
+}
+
+void sim_set_loop_handler(simLoopHandler handler) {
+	loop_handler = handler;
+}
+
+void sim_init() {
+	htim1.Instance = &sim_tim1;
+	htim1.hdma[TIM_DMA_ID_CC1] = &hdma_tim1_ch1;
+	htim1.hdma[TIM_DMA_ID_CC2] = &hdma_tim1_ch2;
+	htim2.Instance = &sim_tim2;
+	htim3.Instance = &sim_tim3;
+	huart1.Instance = &sim_usart1;
+	huart1.Init.BaudRate = SERIAL_DEFAULT_BAUD;
+	huart1.hdmarx = &hdma_usart1_rx;
+	huart1.hdmatx = &hdma_usart1_tx;
+	sim_usart1.SR = USART_SR_TC | USART_SR_TXE;
+
+	// the same order as main()
+	uptime_init(&htim2, &htim3);
+	profile_init();
+	serial_init(&huart1);
+	stepgen_init(&htim1);
+}
+
+// main_real() never returns, so virtual time running out jumps back here
+
+void sim_run(uint64_t end_time) {
+	sim_end_time = end_time;
+	if (setjmp(sim_exit) == 0) {
+		main_real();
+	}
+}
@@ -0,0 +1,108 @@
+#ifndef SIM_H
+#define SIM_H
+
+// virtual-time simulator for the firmware.  the real main_real(), planner, step engine and command
+// modules run against the stub HAL in stub/, and this stands in for the hardware they drive:
+//
+// - time: uptime() is virtual.  each call moves time on by one microsecond, so the main loop's busy wait
+//   runs through its idle time quickly, and everything else takes no time at all.
+// - TIM1 and its DMA channels: the step engine's ring is played out exactly as the timer would, with
+//   the half and full transfer interrupts called at the points the DMA reaches them.  every step pulse
+//   is recorded with its exact time in TIM1 ticks.
+// - USART1: bytes sent to the firmware arrive at the current baud rate, and replies take as long to go
+//   out as they would on the wire.
+// - the DWT cycle counter counts host nanoseconds, so the profiler (pr=1) measures host time.  in the
+//   emulator build (see ../emu) it counts Cortex-M3 instructions instead.  either way, time the
+//   simulation spends on itself is left out, so only the firmware's own work is counted.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fixed.h"
+
+#define SIM_TICKS_PER_US 8
+
+typedef struct simStep {
+	uint64_t tick;
+	int8_t direction;
+	bool enabled;
+	int position;
+} simStep;
+
+typedef struct simDirection {
+	uint64_t tick;
+	int8_t direction;
+} simDirection;
+
+typedef struct simSample {
+	uint64_t time;
+	fix_pos position;
+} simSample;
+
+#ifdef SIM_EMU
+#define SIM_CYCLE_UNITS "instructions"
+#else
+#define SIM_CYCLE_UNITS "ns"
+#endif
+
+typedef void (*simTxHandler)(const uint8_t* data, int len, uint64_t time);
+typedef void (*simPollHandler)(uint64_t time);
+typedef void (*simLoopHandler)(uint32_t cycles, uint64_t time);
+
+extern uint64_t sim_time;
+
+extern simStep* sim_steps;
+extern int sim_steps_len;
+
+// every change of the direction pin, in TIM1 ticks like the steps
+extern simDirection* sim_directions;
+extern int sim_directions_len;
+
+extern simSample* sim_samples;
+extern int sim_samples_len;
+
+// sets up the peripherals the way main() does and starts the firmware's modules
+
+void sim_init();
+
+// runs main_real() until the given time in microseconds
+
+void sim_run(uint64_t end_time);
+
+// bytes to arrive at the firmware's serial port, starting at the given time (or as soon as the ones
+// before them are in)
+
+void sim_receive(const uint8_t* data, int len, uint64_t time);
+
+// how many more bytes sim_receive() can take at the given time without any of them arriving after
+// time + window, at the current baud rate
+
+int sim_receive_room(uint64_t time, uint64_t window);
+
+// called with everything the firmware sends, when the last byte of it is out
+
+void sim_set_tx_handler(simTxHandler handler);
+
+// called once every virtual millisecond
+
+void sim_set_poll_handler(simPollHandler handler);
+
+// called after each main loop iteration, with what it cost in SIM_CYCLE_UNITS (as the profiler's loop
+// section measured it)
+
+void sim_set_loop_handler(simLoopHandler handler);
+
+// the raw cycle counter, with the simulation's own time still in it.  sim.c has the host's;
+// the emulator build brings its own.
+
+uint32_t sim_cycles();
+
+// the serial port's baud rate, as the firmware has set it
+
+uint32_t sim_baud();
+
+// caps the rate bytes actually move at, below whatever the firmware has set, like a slower link in
+// between.  0 takes the cap off.
+
+void sim_set_wire_limit(uint32_t baud);
+
+#endif
@@ -0,0 +1,146 @@
+// runs the simulated firmware behind a pseudo-terminal, so host software can talk to it as if it were
+// the controller on a serial port.
+//
+// usage: stepdev [-b baud] [-l link] [-f]
+//
+// the name of the terminal is printed at start up, and -l also makes a symlink to it.  bytes written
+// to the terminal go to the firmware's serial port, and its replies come back out.  both directions
+// move at the firmware's baud rate, as set by br=, or at -b if that's lower, so a client that sends
+// faster than the link can carry sees the same back-pressure it would on the real controller.
+//
+// virtual time is kept in step with the wall clock, unless -f is given, in which case it runs as fast
+// as it can whenever there's something to do.  stop it with ctrl-c.
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include "sim.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// how often poll_terminal() runs, in virtual microseconds
+#define STEPDEV_POLL_US 1000
+
+static int master = -1;
+static bool fast = false;
+static uint64_t wall_start = 0;
+
+static uint64_t wall_time() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+static void send_reply(const uint8_t* data, int len, uint64_t time) {
+	while (len > 0) {
+		ssize_t sent = write(master, data, len);
+		if (sent < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+		data += sent;
+		len -= sent;
+	}
+}
+
+// once a virtual millisecond: pick up what the client has written, and keep pace with the wall clock.
+// only as much is read as the wire can carry before the next poll, so the rest stays in the terminal.
+// once that's full, the client's write() blocks, as it would on a real serial port.
+
+static void poll_terminal(uint64_t time) {
+	uint8_t data[256];
+	int room = sim_receive_room(time, STEPDEV_POLL_US);
+	if (room > (int)sizeof(data)) {
+		room = sizeof(data);
+	}
+	ssize_t len = room > 0 ? read(master, data, room) : 0;
+	if (len > 0) {
+		sim_receive(data, len, time);
+	}
+	else if (fast && room > 0) {
+		// nothing to do, so don't spin through virtual time
+		usleep(1000);
+	}
+
+	if (!fast) {
+		uint64_t wall = wall_time() - wall_start;
+		if (time > wall) {
+			usleep(time - wall);
+		}
+	}
+}
+
+static int open_terminal(const char* link) {
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+		perror("posix_openpt");
+		return -1;
+	}
+	const char* name = ptsname(master);
+
+	// raw bytes both ways, like a serial port.  keeping the other end open here means the terminal
+	// stays up while clients come and go.
+	int slave = open(name, O_RDWR | O_NOCTTY);
+	if (slave < 0) {
+		perror(name);
+		return -1;
+	}
+	struct termios tio;
+	tcgetattr(slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+
+	fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+	if (link) {
+		unlink(link);
+		if (symlink(name, link) < 0) {
+			perror(link);
+			return -1;
+		}
+	}
+	printf("%s\n", name);
+	fflush(stdout);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	const char* link = 0;
+	uint32_t wire_limit = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			wire_limit = atol(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+			link = argv[++i];
+		}
+		else if (strcmp(argv[i], "-f") == 0) {
+			fast = true;
+		}
+		else {
+			fprintf(stderr, "usage: %s [-b baud] [-l link] [-f]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (open_terminal(link) < 0) {
+		return 1;
+	}
+
+	sim_set_wire_limit(wire_limit);
+	sim_set_tx_handler(send_reply);
+	sim_set_poll_handler(poll_terminal);
+	sim_init();
+	wall_start = wall_time();
+	sim_run(UINT64_MAX);
+	return 0;
+}
@@ -0,0 +1,458 @@
+// replays a command script through the firmware in virtual time, and reports how the motor moved.
+//
+// usage: stepsim [-q] [-t end_ms] [-o trace.csv] [-g golden.csv] [-e steps] [-r percent] [-d steps] script
+//
+// each script line is a time in milliseconds and an ascii command, which is sent twice as the ascii
+// protocol wants.  blank lines and lines starting with # are skipped.
+//
+//   0 mv=180
+//   0 tp=90
+//   2500 tv=-45
+//
+// the firmware's replies are printed as they go out, unless -q.  the run ends at end_ms, or one second
+// after the last command.  the trace is the step and direction
+// timeline, one edge per line, with times in TIM1 ticks (8 per microsecond):
+//
+//   <tick>,dir,<1 or -1>       the direction pin changed
+//   <tick>,step,<position>     a step pulse started, and the position after it
+//
+// -g compares the trace with a golden one, and fails at the first edge that's different.  the run also
+// fails if a step comes sooner after a direction change than the driver allows, or if a motion quality
+// number below goes over its limit: -e for the max following error, -r for the velocity ripple and -d for
+// the steps while disabled.  each is only checked if it's given.
+//
+// the motion quality numbers, all from the planner's samples and the steps that went out:
+//
+// - following error: the planner's target at each sample, against the position at that moment
+// - step timing: when each step went out, against when the planner's path crossed the step boundary the
+//   step engine steps at.  the mean is the step engine's constant latency; the jitter is how far any step
+//   strays from that.
+// - velocity ripple: while the planner's velocity holds steady and the steps are keeping up with it,
+//   how far the rate of each step (one over its period) is from it
+
+#include "sim.h"
+#include "profile.h"
+#include "stepper.h"
+#include "stepgen.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// velocities within this fraction of each other count as steady, for velocity ripple
+#define STEADY_VELOCITY 0.000001
+
+typedef struct stepTiming {
+	double mean_us;
+	double jitter_us;
+	double rms_us;
+} stepTiming;
+
+static void print_reply(const uint8_t* data, int len, uint64_t time) {
+	static bool line_start = true;
+	for (int i = 0; i < len; i++) {
+		if (line_start) {
+			printf("[%10.3f ms] ", time / 1000.0);
+			line_start = false;
+		}
+		if (data[i] == '\n') {
+			printf("\n");
+			line_start = true;
+		}
+		else if (data[i] >= ' ' && data[i] < 0x7f) {
+			putchar(data[i]);
+		}
+		else {
+			printf("\\x%02x", data[i]);
+		}
+	}
+}
+
+static uint64_t load_script(const char* path) {
+	FILE* file = fopen(path, "r");
+	if (!file) {
+		perror(path);
+		exit(2);
+	}
+	char line[256];
+	uint64_t last = 0;
+	while (fgets(line, sizeof(line), file)) {
+		double ms;
+		char command[200];
+		if (line[0] == '#' || sscanf(line, "%lf %199s", &ms, command) != 2) {
+			continue;
+		}
+		uint64_t time = ms * 1000;
+		strcat(command, "\n");
+		sim_receive((const uint8_t*)command, strlen(command), time);
+		sim_receive((const uint8_t*)command, strlen(command), time);
+		if (time > last) {
+			last = time;
+		}
+	}
+	fclose(file);
+	return last;
+}
+
+// the planner's target at each sample it took, against where the motor actually was at that moment.
+// the step engine samples ahead, so the last few samples are past the end of the run.
+
+static double max_following_error() {
+	double max = 0;
+	int step = 0;
+	int position = 0;
+	for (int i = 0; i < sim_samples_len && sim_samples[i].time <= sim_time; i++) {
+		uint64_t tick = sim_samples[i].time * SIM_TICKS_PER_US;
+		while (step < sim_steps_len && sim_steps[step].tick <= tick) {
+			position = sim_steps[step++].position;
+		}
+		double error = (double)sim_samples[i].position / FIX_POS_ONE_STEP - position;
+		if (error < 0) {
+			error = -error;
+		}
+		if (error > max) {
+			max = error;
+		}
+	}
+	return max;
+}
+
+// where the planner's target (truncated toward zero) moves on from position to the next step in the
+// given direction, as stepgen_boundary() in the firmware works it out
+
+static double step_boundary(int position, int direction) {
+	if (direction > 0) {
+		return position >= 0 ? position + 1 : position;
+	}
+	return position > 0 ? position : position - 1;
+}
+
+static double sample_steps(int i) {
+	return (double)sim_samples[i].position / FIX_POS_ONE_STEP;
+}
+
+// the last sample at or before a tick
+
+static int sample_at(int64_t tick) {
+	int low = 0;
+	int high = sim_samples_len;
+	while (high - low > 1) {
+		int middle = (low + high) / 2;
+		if ((int64_t)sim_samples[middle].time * SIM_TICKS_PER_US <= tick) {
+			low = middle;
+		}
+		else {
+			high = middle;
+		}
+	}
+	return low;
+}
+
+// the planner's velocity from one sample to the next, in steps per tick
+
+static double sample_velocity(int i) {
+	double ticks = (double)(sim_samples[i + 1].time - sim_samples[i].time) * SIM_TICKS_PER_US;
+	return ticks > 0 ? (sample_steps(i + 1) - sample_steps(i)) / ticks : 0;
+}
+
+// the planner's position at a tick, between the samples either side of it
+
+static double planner_position(int64_t tick) {
+	int i = sample_at(tick);
+	if (i + 1 >= sim_samples_len) {
+		return sample_steps(i);
+	}
+	return sample_steps(i) + sample_velocity(i) * (double)(tick - (int64_t)sim_samples[i].time * SIM_TICKS_PER_US);
+}
+
+// the planner's velocity if it held steady from one tick to another, otherwise 0
+
+static double steady_velocity(int64_t from, int64_t to) {
+	int first = sample_at(from);
+	int last = sample_at(to);
+	if (last + 1 >= sim_samples_len) {
+		return 0;
+	}
+	double velocity = sample_velocity(first);
+	for (int i = first + 1; i <= last; i++) {
+		if (fabs(sample_velocity(i) - velocity) > STEADY_VELOCITY * fabs(velocity)) {
+			return 0;
+		}
+	}
+	return velocity;
+}
+
+// each step against the tick the planner's path, between samples, crossed its boundary
+
+static stepTiming step_timing() {
+	stepTiming timing = { 0, 0, 0 };
+	double* error = malloc(sim_steps_len * sizeof(double));
+	int counted = 0;
+	int sample = 0;
+	for (int i = 0; i < sim_steps_len; i++) {
+		int direction = sim_steps[i].direction;
+		double boundary = step_boundary(sim_steps[i].position - direction, direction);
+		// the first stretch of the path that moves this way and reaches the boundary
+		while (sample + 1 < sim_samples_len && ((sample_steps(sample + 1) - boundary) * direction < 0
+				|| (sample_steps(sample + 1) - sample_steps(sample)) * direction <= 0)) {
+			sample++;
+		}
+		if (sample + 1 >= sim_samples_len) {
+			break;
+		}
+		double from = sample_steps(sample);
+		double to = sample_steps(sample + 1);
+		double fraction = to != from ? (boundary - from) / (to - from) : 1;
+		if (fraction < 0) {
+			fraction = 0;
+		}
+		if (fraction > 1) {
+			fraction = 1;
+		}
+		double start = sim_samples[sample].time;
+		double ideal = start + fraction * (sim_samples[sample + 1].time - start);
+		error[counted] = sim_steps[i].tick / (double)SIM_TICKS_PER_US - ideal;
+		timing.mean_us += error[counted];
+		counted++;
+	}
+	if (counted > 0) {
+		timing.mean_us /= counted;
+		double squares = 0;
+		for (int i = 0; i < counted; i++) {
+			double deviation = fabs(error[i] - timing.mean_us);
+			if (deviation > timing.jitter_us) {
+				timing.jitter_us = deviation;
+			}
+			squares += deviation * deviation;
+		}
+		timing.rms_us = sqrt(squares / counted);
+	}
+	free(error);
+	return timing;
+}
+
+// the largest difference between a step's rate and the planner's steady velocity, as a fraction of it
+
+static double velocity_ripple() {
+	double max = 0;
+	for (int i = 1; i < sim_steps_len; i++) {
+		if (sim_steps[i].direction != sim_steps[i - 1].direction) {
+			continue;
+		}
+		// steady from a sample before the period to a sample after it
+		double velocity = steady_velocity(sim_steps[i - 1].tick - STEPGEN_SAMPLE_TICKS, sim_steps[i].tick + STEPGEN_SAMPLE_TICKS);
+		if (velocity == 0) {
+			continue;
+		}
+		// steps the engine is still catching up with aren't following the planner's velocity
+		if (fabs(planner_position(sim_steps[i].tick) - sim_steps[i].position) > 1) {
+			continue;
+		}
+		double rate = 1.0 / (sim_steps[i].tick - sim_steps[i - 1].tick);
+		double ripple = fabs(rate - fabs(velocity)) / fabs(velocity);
+		if (ripple > max) {
+			max = ripple;
+		}
+	}
+	return max;
+}
+
+// the shortest time from a change of direction to the next step, in ticks.  -1 if it never changed.
+
+static int64_t direction_setup() {
+	int64_t min = -1;
+	int change = 0;
+	for (int i = 0; i < sim_steps_len; i++) {
+		bool changed = false;
+		while (change < sim_directions_len && sim_directions[change].tick <= sim_steps[i].tick) {
+			change++;
+			changed = true;
+		}
+		if (changed) {
+			int64_t setup = sim_steps[i].tick - sim_directions[change - 1].tick;
+			if (min < 0 || setup < min) {
+				min = setup;
+			}
+		}
+	}
+	return min;
+}
+
+// the trace, one edge at a time in time order.  a direction change comes before a step at the same tick.
+
+static int trace_line(int* step, int* change, char* line, int size) {
+	if (*change < sim_directions_len && (*step >= sim_steps_len || sim_directions[*change].tick <= sim_steps[*step].tick)) {
+		simDirection* edge = &sim_directions[(*change)++];
+		return snprintf(line, size, "%llu,dir,%d\n", (unsigned long long)edge->tick, edge->direction);
+	}
+	if (*step < sim_steps_len) {
+		simStep* edge = &sim_steps[(*step)++];
+		return snprintf(line, size, "%llu,step,%d\n", (unsigned long long)edge->tick, edge->position);
+	}
+	return 0;
+}
+
+static bool write_trace(const char* path) {
+	FILE* trace = fopen(path, "w");
+	if (!trace) {
+		perror(path);
+		return false;
+	}
+	char line[64];
+	int step = 0;
+	int change = 0;
+	while (trace_line(&step, &change, line, sizeof(line))) {
+		fputs(line, trace);
+	}
+	fclose(trace);
+	return true;
+}
+
+static bool compare_trace(const char* path) {
+	FILE* golden = fopen(path, "r");
+	if (!golden) {
+		perror(path);
+		return false;
+	}
+	char line[64];
+	char want[64];
+	int step = 0;
+	int change = 0;
+	int number = 0;
+	bool same = true;
+	while (true) {
+		bool have = trace_line(&step, &change, line, sizeof(line)) > 0;
+		bool wanted = fgets(want, sizeof(want), golden) != 0;
+		number++;
+		if (!have && !wanted) {
+			break;
+		}
+		if (!have || !wanted || strcmp(line, want) != 0) {
+			printf("trace differs from %s at edge %d\n", path, number);
+			printf("  got:  %s", have ? line : "(end)\n");
+			printf("  want: %s", wanted ? want : "(end)\n");
+			same = false;
+			break;
+		}
+	}
+	fclose(golden);
+	if (same) {
+		printf("trace matches %s, %d edges\n", path, number - 1);
+	}
+	return same;
+}
+
+int main(int argc, char** argv) {
+	const char* trace_path = 0;
+	const char* golden_path = 0;
+	bool quiet = false;
+	double end_ms = -1;
+	double max_error = -1;
+	double max_ripple = -1;
+	int max_disabled = -1;
+	int opt = 1;
+	for (; opt < argc - 1; opt++) {
+		if (strcmp(argv[opt], "-q") == 0) {
+			quiet = true;
+		}
+		else if (strcmp(argv[opt], "-t") == 0 && opt + 1 < argc - 1) {
+			end_ms = atof(argv[++opt]);
+		}
+		else if (strcmp(argv[opt], "-o") == 0 && opt + 1 < argc - 1) {
+			trace_path = argv[++opt];
+		}
+		else if (strcmp(argv[opt], "-g") == 0 && opt + 1 < argc - 1) {
+			golden_path = argv[++opt];
+		}
+		else if (strcmp(argv[opt], "-e") == 0 && opt + 1 < argc - 1) {
+			max_error = atof(argv[++opt]);
+		}
+		else if (strcmp(argv[opt], "-r") == 0 && opt + 1 < argc - 1) {
+			max_ripple = atof(argv[++opt]);
+		}
+		else if (strcmp(argv[opt], "-d") == 0 && opt + 1 < argc - 1) {
+			max_disabled = atoi(argv[++opt]);
+		}
+		else {
+			break;
+		}
+	}
+	if (opt != argc - 1) {
+		fprintf(stderr, "usage: %s [-q] [-t end_ms] [-o trace.csv] [-g golden.csv] [-e steps] [-r percent] [-d steps] "
+				"script\n", argv[0]);
+		return 2;
+	}
+
+	if (!quiet) {
+		sim_set_tx_handler(print_reply);
+	}
+	sim_init();
+	uint64_t last = load_script(argv[opt]);
+	uint64_t end = end_ms >= 0 ? (uint64_t)(end_ms * 1000) : last + 1000000;
+	sim_run(end);
+
+	uint64_t min_period = 0;
+	for (int i = 1; i < sim_steps_len; i++) {
+		uint64_t period = sim_steps[i].tick - sim_steps[i - 1].tick;
+		if (i == 1 || period < min_period) {
+			min_period = period;
+		}
+	}
+
+	printf("time %.3f ms\n", end / 1000.0);
+	printf("steps %d, final position %d\n", sim_steps_len, sim_steps_len ? sim_steps[sim_steps_len - 1].position : 0);
+	printf("shortest step period %.3f us\n", min_period / (double)SIM_TICKS_PER_US);
+	double error = max_following_error();
+	printf("max following error %.3f steps\n", error);
+
+	stepTiming timing = step_timing();
+	printf("step timing mean %.3f us, jitter %.3f us, rms %.3f us\n", timing.mean_us, timing.jitter_us, timing.rms_us);
+	double ripple = 100 * velocity_ripple();
+	printf("velocity ripple %.3f%%\n", ripple);
+
+	int disabled = 0;
+	for (int i = 0; i < sim_steps_len; i++) {
+		disabled += !sim_steps[i].enabled;
+	}
+	printf("steps while disabled %d\n", disabled);
+
+	int status = 0;
+	if (max_error >= 0 && error > max_error) {
+		printf("following error is over the limit of %.3f steps\n", max_error);
+		status = 1;
+	}
+	if (max_ripple >= 0 && ripple > max_ripple) {
+		printf("velocity ripple is over the limit of %.3f%%\n", max_ripple);
+		status = 1;
+	}
+	if (max_disabled >= 0 && disabled > max_disabled) {
+		printf("steps while disabled are over the limit of %d\n", max_disabled);
+		status = 1;
+	}
+	int64_t setup = direction_setup();
+	if (setup >= 0) {
+		printf("shortest direction setup %.3f us\n", setup / (double)SIM_TICKS_PER_US);
+		if (setup < STEPPER_DIRECTION_SETUP_US * SIM_TICKS_PER_US) {
+			printf("direction setup is shorter than the driver's %d us\n", STEPPER_DIRECTION_SETUP_US);
+			status = 1;
+		}
+	}
+
+	// the cycle counter counts host nanoseconds here
+	static const char* const names[PROFILE_SECTIONS] = { "poll", "plan", "step", "loop", "refill" };
+	for (int i = 0; i < PROFILE_SECTIONS; i++) {
+		profileStats* stats = &profile_stats[i];
+		printf("%-6s n=%lu min=%lu max=%lu mean=%lu ns\n", names[i], (unsigned long)stats->count,
+				stats->count ? (unsigned long)stats->min : 0, (unsigned long)stats->max,
+				stats->count ? (unsigned long)(stats->total / stats->count) : 0);
+	}
+
+	if (trace_path && !write_trace(trace_path)) {
+		return 2;
+	}
+	if (golden_path && !compare_trace(golden_path)) {
+		status = 1;
+	}
+	return status;
+}
@@ -0,0 +1,154 @@
+// host stand-in for the STM32F1 HAL, just enough for the firmware modules the simulator builds.
+// registers are plain memory.  the handful of things that have to act like hardware (starting TIM1, the
+// DMA and UART calls, and the cycle counter) are routed to the simulator in sim.c.
+
+#ifndef SIM_STM32F1XX_HAL_H
+#define SIM_STM32F1XX_HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+	HAL_OK = 0,
+	HAL_ERROR = 1,
+	HAL_BUSY = 2,
+	HAL_TIMEOUT = 3,
+} HAL_StatusTypeDef;
+
+typedef enum {
+	GPIO_PIN_RESET = 0,
+	GPIO_PIN_SET = 1,
+} GPIO_PinState;
+
+typedef struct {
+	volatile uint32_t CRL, CRH, IDR, ODR, BSRR, BRR, LCKR;
+} GPIO_TypeDef;
+
+typedef struct {
+	volatile uint32_t CR1, CR2, SMCR, DIER, SR, EGR, CCMR1, CCMR2, CCER, CNT, PSC, ARR, RCR;
+	volatile uint32_t CCR1, CCR2, CCR3, CCR4, BDTR, DCR, DMAR;
+} TIM_TypeDef;
+
+typedef struct {
+	volatile uint32_t SR, DR, BRR, CR1, CR2, CR3, GTPR;
+} USART_TypeDef;
+
+typedef struct {
+	volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef struct {
+	volatile uint32_t CTRL, CYCCNT;
+} DWT_Type;
+
+typedef struct __DMA_HandleTypeDef {
+	void (*XferCpltCallback)(struct __DMA_HandleTypeDef* hdma);
+	void (*XferHalfCpltCallback)(struct __DMA_HandleTypeDef* hdma);
+	uint32_t remaining;
+} DMA_HandleTypeDef;
+
+typedef struct {
+	TIM_TypeDef* Instance;
+	DMA_HandleTypeDef* hdma[7];
+} TIM_HandleTypeDef;
+
+typedef struct {
+	uint32_t BaudRate;
+} UART_InitTypeDef;
+
+typedef enum {
+	HAL_UART_STATE_READY = 0x20,
+	HAL_UART_STATE_BUSY_TX = 0x21,
+	HAL_UART_STATE_BUSY_RX = 0x22
+} HAL_UART_StateTypeDef;
+
+typedef struct {
+	USART_TypeDef* Instance;
+	UART_InitTypeDef Init;
+	HAL_UART_StateTypeDef gState;
+	HAL_UART_StateTypeDef RxState;
+	DMA_HandleTypeDef* hdmatx;
+	DMA_HandleTypeDef* hdmarx;
+} UART_HandleTypeDef;
+
+extern GPIO_TypeDef sim_gpioa;
+extern GPIO_TypeDef sim_gpiob;
+extern CoreDebug_Type sim_core_debug;
+DWT_Type* sim_dwt();
+
+#define GPIOA (&sim_gpioa)
+#define GPIOB (&sim_gpiob)
+#define CoreDebug (&sim_core_debug)
+#define DWT (sim_dwt())
+
+#define GPIO_PIN_3 ((uint16_t)0x0008)
+#define GPIO_PIN_4 ((uint16_t)0x0010)
+#define GPIO_PIN_8 ((uint16_t)0x0100)
+#define GPIO_PIN_15 ((uint16_t)0x8000)
+
+#define TIM_CR1_CEN (1 << 0)
+#define TIM_CR1_OPM (1 << 3)
+#define TIM_CR1_ARPE (1 << 7)
+#define TIM_CR2_CCDS (1 << 3)
+#define TIM_EGR_UG (1 << 0)
+#define TIM_CCMR1_OC1PE (1 << 3)
+#define TIM_CCMR1_OC1M (7 << 4)
+#define TIM_OCMODE_PWM2 (7 << 4)
+#define TIM_CCER_CC1E (1 << 0)
+#define TIM_DMABASE_ARR 11
+#define TIM_DMABURSTLENGTH_3TRANSFERS (2 << 8)
+#define TIM_DMA_CC1 (1 << 9)
+#define TIM_DMA_CC2 (1 << 10)
+#define TIM_DMA_ID_CC1 1
+#define TIM_DMA_ID_CC2 2
+#define TIM_CHANNEL_1 0
+
+#define USART_SR_TC (1 << 6)
+#define USART_SR_TXE (1 << 7)
+#define USART_CR1_UE (1 << 13)
+
+#define CoreDebug_DEMCR_TRCENA_Msk (1 << 24)
+#define DWT_CTRL_CYCCNTENA_Msk (1 << 0)
+
+#define __NVIC_PRIO_BITS 4
+
+#define MODIFY_REG(reg, clear, set) ((reg) = ((reg) & ~(clear)) | (set))
+
+#define UART_DIV_SAMPLING16(pclk, baud) ((((uint64_t)(pclk)) * 25U) / (4U * ((uint64_t)(baud))))
+#define UART_DIVMANT_SAMPLING16(pclk, baud) (UART_DIV_SAMPLING16((pclk), (baud)) / 100U)
+#define UART_DIVFRAQ_SAMPLING16(pclk, baud) ((((UART_DIV_SAMPLING16((pclk), (baud)) - (UART_DIVMANT_SAMPLING16((pclk), (baud)) * 100U)) * 16U) + 50U) / 100U)
+#define UART_BRR_SAMPLING16(pclk, baud) ((UART_DIVMANT_SAMPLING16((pclk), (baud)) << 4U) + \
+		(UART_DIVFRAQ_SAMPLING16((pclk), (baud)) & 0xF0U) + (UART_DIVFRAQ_SAMPLING16((pclk), (baud)) & 0x0FU))
+
+void sim_tim_enable(TIM_HandleTypeDef* htim);
+void sim_tim_disable(TIM_HandleTypeDef* htim);
+
+#define __HAL_TIM_ENABLE(h) sim_tim_enable(h)
+#define __HAL_TIM_DISABLE(h) sim_tim_disable(h)
+#define __HAL_TIM_MOE_ENABLE(h) ((h)->Instance->BDTR |= (1 << 15))
+#define __HAL_TIM_ENABLE_DMA(h, dma) ((h)->Instance->DIER |= (dma))
+#define __HAL_DMA_GET_COUNTER(h) ((h)->remaining)
+
+// the simulator runs everything on one thread, so there are no interrupts to mask
+static inline void __DMB() {}
+static inline void __disable_irq() {}
+static inline uint32_t __get_PRIMASK() { return 0; }
+static inline void __set_PRIMASK(uint32_t primask) {}
+static inline uint32_t __get_BASEPRI() { return 0; }
+static inline void __set_BASEPRI(uint32_t basepri) {}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* port, uint16_t pin, GPIO_PinState state);
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef* htim, uint32_t channel);
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef* htim);
+HAL_StatusTypeDef HAL_DMA_Start(DMA_HandleTypeDef* hdma, uint32_t src, uint32_t dst, uint32_t len);
+HAL_StatusTypeDef HAL_DMA_Start_IT(DMA_HandleTypeDef* hdma, uint32_t src, uint32_t dst, uint32_t len);
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef* huart, uint8_t* data, uint16_t size);
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef* huart, const uint8_t* data, uint16_t size);
+uint32_t HAL_RCC_GetPCLK2Freq();
+
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef* huart, uint16_t size);
+void HAL_UART_ErrorCallback(UART_HandleTypeDef* huart);
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef* huart);
+
+#endif